@@ -81,7 +81,7 @@ int main (int argc, char * argv[])
   printf ("Computed %d/%d %2.0f%% correct values\n", correct, count,
           (float)correct/count*100.f);
 
-  CL_SAFE(clReleaseKernel (kernel));
+  releaseKernel( kernel);
   CL_SAFE(freeDevice());
 
   timeDirectImplementation( count, data, results);
@@ -0,0 +1,47 @@
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+#include <vector>
+
+#include "simple.hpp"
+
+#define DATA_SIZE 10240000
+
+int main (int argc, char * argv[])
+{
+  size_t local = (argc < 2 ? 32 : atoi(argv[1]));
+  unsigned int count = DATA_SIZE;
+  char *KernelSource = readOpenCL( (char *)"square.cl");
+
+  std::vector<float> data( count);
+  std::vector<float> results( count);
+
+  /* Fill the vector with random float values.  */
+  for (auto &d : data)
+    d = rand () / (float) RAND_MAX;
+
+  {
+    simple::Device dev( simple::GPU, true);
+    simple::Kernel square( KernelSource, "square");
+
+    square.run<1>( {count}, {local}, std::span<const float>( data),
+                                     std::span<float>( results),
+                                     count);
+
+    printKernelTime();
+    printTransferTimes();
+  }
+
+  /* Validate our results.  */
+  unsigned int correct = 0;
+  for (unsigned int i = 0; i < count; i++)
+    if (results[i] == data[i] * data[i])
+      correct++;
+
+  printf ("Computed %u/%u %2.0f%% correct values\n", correct, count,
+          (float)correct/count*100.f);
+
+  free( KernelSource);
+
+  return 0;
+}
@@ -1,27 +1,132 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <CL/cl.h>
 #include "simple.h"
 
 typedef struct {
   clarg_type arg_t;
-  cl_mem dev_buf;
+  int    mem_id;
   double *double_host_buf;
   float *float_host_buf;
   int *int_host_buf;
   bool *bool_host_buf;
-  int    num_elems;
+  cl_half *cl_half_host_buf;
+  cl_char *cl_char_host_buf;
+  cl_uchar *cl_uchar_host_buf;
+  cl_short *cl_short_host_buf;
+  cl_ushort *cl_ushort_host_buf;
+  cl_long *cl_long_host_buf;
+  cl_ulong *cl_ulong_host_buf;
+  size_t num_elems;
   int    val;
   float valf;
   double vald;
+  void  *svm_ptr;
 } kernel_arg;
 
+struct ew_expr {
+  ew_op    op;
+  int      arg;              /* EwArg */
+  double   val;              /* EwConst */
+  ew_expr *left;
+  ew_expr *right;
+};
+
+typedef struct {
+  char      *source;
+  cl_kernel  kernel;
+  cl_program program;
+} ew_cache_entry;
+
+struct build_handle {
+  cl_program      program;
+  char           *source;
+  char           *options;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  bool            done;
+  bool            joined;
+  cl_int          err;
+};
+
 #define MAX_ARG 10
 
+/*
+ * Every device buffer allocated through the wrapper has an entry in the
+ * memory table. Buffers that belong to kernel arguments set up by setupKernel
+ * are owned by the wrapper and may be spilled to host memory when the memory
+ * budget is exceeded; they are restored before the next launch of their kernel.
+ */
+typedef struct {
+  bool      in_use;
+  bool      spillable;
+  cl_mem    buf;           /* NULL while spilled */
+  void     *host_copy;     /* non-NULL while spilled */
+  size_t    size;
+  cl_kernel kernel;
+  int       arg_idx;
+  unsigned long last_use;
+  bool      captured;      /* allocation has been recorded */
+  cl_event  last_write;    /* concurrent mode: last command writing the buffer */
+  cl_event *reads;         /* concurrent mode: commands reading it since then */
+  int       num_reads;
+  int       max_reads;
+} mem_entry;
+
+/*
+ * In concurrent mode, buffer arguments set via setKernelArg are bound to
+ * their kernels so that launches can wait for exactly the commands that
+ * produce or consume the buffers they use. SVM pointers are not resolved
+ * to allocations; all launches using any SVM are serialised instead.
+ */
+typedef struct {
+  cl_kernel  kernel;
+  cl_uint    idx;
+  int        mem_id;       /* SVM_ARG for SVM pointers */
+  arg_access access;
+} arg_binding;
+
+#define SVM_ARG -2
+
+/*
+ * Shared virtual memory allocations. Coarse-grained allocations need to be
+ * mapped while the host accesses them; we keep them mapped between launches.
+ */
+typedef struct {
+  void  *ptr;
+  size_t size;
+  bool   mapped;
+} svm_entry;
+
+/*
+ * Pinned host memory is backed by CL_MEM_ALLOC_HOST_PTR buffers that stay
+ * mapped for their whole lifetime. Large transfers from or to pageable memory
+ * are chunked through a ring of such buffers so that copying into one slot
+ * overlaps with the DMA transfer of the other.
+ */
+typedef struct {
+  void  *ptr;
+  cl_mem buf;
+  size_t size;
+} pinned_entry;
+
+typedef enum {
+  XferPageable,
+  XferPinned,
+  XferStaged
+} xfer_kind;
+
+#define STAGING_SLOTS 2
+#define STAGING_CHUNK (4*1048576)
+
 
 #define die(msg, ...) do {                      \
   (void) fprintf (stderr, msg, ## __VA_ARGS__); \
@@ -29,9 +134,83 @@ typedef struct {
   exit (EXIT_FAILURE);                          \
 } while (0)
 
+/*
+ * Instrumentation. Building with -DSIMPLE_NO_INSTR compiles out all wallclock
+ * timing and verbose logging of the wrapper; only the call counts remain.
+ * Building with -DSIMPLE_COUNT_OVERHEAD measures the time spent in the hot
+ * entry points (transfers, setKernelArg, launches, syncBatch) and, separately,
+ * the part of it spent inside OpenCL calls; see printOverhead.
+ */
+#ifdef SIMPLE_NO_INSTR
+#define TIMER_START() do {} while (0)
+#define TIMER_STOP() do {} while (0)
+#else
+#define TIMER_START() clock_gettime( CLOCK_REALTIME, &start)
+#define TIMER_STOP()  clock_gettime( CLOCK_REALTIME, &stop)
+#endif
+
+#ifdef SIMPLE_COUNT_OVERHEAD
+static int ov_depth = 0;              /* nesting of instrumented entry points */
+static struct timespec ov_entry;
+static unsigned long ov_calls = 0;
+static double ov_total = 0.0;         /* msec spent in the entry points */
+static double ov_cl = 0.0;            /* msec thereof spent in OpenCL calls */
+
+static double msecSince( struct timespec *t)
+{
+  struct timespec now;
+
+  clock_gettime( CLOCK_REALTIME, &now);
+  return (now.tv_sec -t->tv_sec)*1000.0 + (now.tv_nsec -t->tv_nsec)/1000000.0;
+}
+
+#define API_ENTER() do {                                                        \
+    if (ov_depth++ == 0)                                                        \
+      clock_gettime( CLOCK_REALTIME, &ov_entry);                                \
+} while (0)
+
+#define API_LEAVE() do {                                                        \
+    if (--ov_depth == 0) {                                                      \
+      ov_calls++;                                                               \
+      ov_total += msecSince( &ov_entry);                                        \
+    }                                                                           \
+} while (0)
+
+#define CL_BEGIN() struct timespec cl_entry;                                    \
+                   clock_gettime( CLOCK_REALTIME, &cl_entry)
+
+#define CL_END() do {                                                           \
+    if (ov_depth > 0)                                                           \
+      ov_cl += msecSince( &cl_entry);                                           \
+} while (0)
+
+/* all checked OpenCL calls of the wrapper are accounted for */
+#undef CL_SAFE
+#define CL_SAFE(fncall)                                                         \
+{                                                                               \
+    CL_BEGIN();                                                                 \
+    cl_int err = fncall;                                                        \
+    CL_END();                                                                   \
+    if (err != CL_SUCCESS) {                                                    \
+        fprintf(stderr, "%s:%d call %s failed with error %s:\n",                \
+                        __FILE__, __LINE__, #fncall, errToStr(err));            \
+        exit(err);                                                              \
+    }                                                                           \
+}
+#else
+#define API_ENTER() do {} while (0)
+#define API_LEAVE() do {} while (0)
+#define CL_BEGIN() do {} while (0)
+#define CL_END() do {} while (0)
+#endif
+
 /* global setup */
 
+#ifdef SIMPLE_NO_INSTR
+static const bool verbose = false;
+#else
 static bool verbose = false;
+#endif
 static cl_platform_id cpPlatform;     /* openCL platform.  */
 static cl_device_id device_id;        /* Compute device id.  */
 static cl_context context;            /* Compute context.  */
@@ -48,6 +227,70 @@ static int num_h2d = 0;
 static double d2h_time = 0.0;
 static int num_d2h = 0;
 
+/* device memory accounting */
+static mem_entry *mem_table = NULL;
+static int num_mem_entries = 0;
+static size_t mem_live = 0;
+static size_t mem_budget = 0;
+static bool mem_budget_set = false;       /* false: device size at init */
+static unsigned long mem_tick = 0;
+static int num_spills = 0;
+static int num_restores = 0;
+static size_t spill_bytes = 0;
+
+/* shared virtual memory */
+static bool svm_coarse = false;
+static bool svm_fine = false;
+static svm_entry *svm_table = NULL;
+static int num_svm = 0;
+static int max_svm = 0;
+
+/* optional element types */
+static bool has_fp16 = false;
+static bool has_int64 = false;
+
+/* pinned host memory and the staging ring */
+static pinned_entry *pinned_table = NULL;
+static int num_pinned = 0;
+static int max_pinned = 0;
+static size_t staging_threshold = 0;
+static bool staging_threshold_set = false;  /* false: chosen at init */
+static void *staging_ptr[STAGING_SLOTS];
+static cl_mem staging_buf[STAGING_SLOTS];
+static bool staging_ready = false;
+static size_t xfer_bytes[3];
+static double xfer_time[3];
+
+/* fused element-wise kernels, keyed by their generated source */
+static ew_cache_entry *ew_cache = NULL;
+static int num_ew_cache = 0;
+
+/* largest global size per axis of a single enqueue and of the device */
+static size_t max_launch_size = 0xFFFFFFFF;
+static bool max_launch_size_set = false;    /* false: derived at init */
+static size_t max_dev_size = 0xFFFFFFFF;
+
+/* concurrent execution */
+static cl_command_queue *conc_queues = NULL;
+static int num_conc_queues = 0;
+static int next_conc_queue = 0;
+static arg_binding *bindings = NULL;
+static int num_bindings = 0;
+static cl_event svm_last = NULL;         /* last launch using SVM */
+
+/* session capture */
+static FILE *capture_file = NULL;
+static cl_kernel *capture_kernels = NULL;
+static int num_capture_kernels = 0;
+
+/* batch mode: launches are only enqueued, their events are kept here */
+static bool batch_mode = false;
+static int batch_sync_every = 0;
+static cl_event *batch_events = NULL;
+static int num_batch_events = 0;         /* one per enqueued chunk */
+static int max_batch_events = 0;
+static int num_batch_launches = 0;       /* one per launch, split or not */
+
 #define CaseReturnString(x) case x: return #x;
 
 const char *errToStr(cl_int err)
@@ -211,6 +454,21 @@ cl_ulong getMemSize( cl_device_id device)
   return res;
 }
 
+/* returns a freshly allocated string for the string valued <param> */
+static char *getDeviceStr( cl_device_id device, cl_device_info param)
+{
+  size_t len;
+  char *res;
+
+  CL_SAFE(clGetDeviceInfo( device, param, 0, NULL, &len));
+  res = (char *)malloc( len+1);
+  if (res == NULL)
+    die ("Error: failed to allocate memory for a device info string");
+  CL_SAFE(clGetDeviceInfo( device, param, len, res, NULL));
+  res[len] = '\0';
+  return res;
+}
+
 size_t getDeviceMaxWorkItems( cl_device_id device, int dim)
 {
    size_t maxWI = 0;
@@ -230,6 +488,31 @@ size_t getDeviceMaxWorkItems( cl_device_id device, int dim)
   return maxWI;
 }
 
+/*
+ * Creates a command queue with the given properties. Profiling is always
+ * enabled so that batched launches can be timed through their events.
+ */
+static cl_command_queue createQueue( cl_command_queue_properties props)
+{
+  cl_int err = CL_SUCCESS;
+  cl_command_queue queue;
+
+#ifndef SIMPLE_NO_INSTR
+  /* batch mode takes kernel times from the event profiling info */
+  props |= CL_QUEUE_PROFILING_ENABLE;
+#endif
+#ifdef CL_VERSION_2_0
+  cl_queue_properties qprops[] = { CL_QUEUE_PROPERTIES, props, 0 };
+  queue = clCreateCommandQueueWithProperties (context, device_id, qprops, &err);
+#else
+  queue = clCreateCommandQueue (context, device_id, props, &err);
+#endif
+  if (!queue || err != CL_SUCCESS) {
+    die ("%s:%d: %s", __FILE__, __LINE__, errToStr(err));
+  }
+  return queue;
+}
+
 cl_int initDevice ( int devType)
 {
   cl_int err = CL_SUCCESS;
@@ -281,14 +564,47 @@ cl_int initDevice ( int devType)
         die ("%s:%d: %s", __FILE__, __LINE__, errToStr(err));
       } else {
         /* Create a command commands.  */
+        commands = createQueue( 0);
+        if (!mem_budget_set)
+          mem_budget = getMemSize( device_id);
+        cl_uint bits;
+        CL_SAFE(clGetDeviceInfo( device_id, CL_DEVICE_ADDRESS_BITS,
+                                 sizeof (cl_uint), &bits, NULL));
+        max_dev_size = (bits >= 64 ? SIZE_MAX : 0xFFFFFFFF);
+        /*
+         * Many runtimes take at most 2^32-1 work items per axis and enqueue
+         * even on 64-bit devices; larger ranges are split by default.
+         */
+        if (!max_launch_size_set)
+          max_launch_size = (max_dev_size < 0xFFFFFFFF ? max_dev_size : 0xFFFFFFFF);
+        /* CPU devices access host memory directly; staging only adds a copy */
+        if (!staging_threshold_set)
+          staging_threshold = (devType == CL_DEVICE_TYPE_CPU ? SIZE_MAX : 1048576);
+        svm_coarse = false;
+        svm_fine = false;
 #ifdef CL_VERSION_2_0
-        commands = clCreateCommandQueueWithProperties (context, device_id, 0, &err);
-#else
-        commands = clCreateCommandQueue (context, device_id, 0, &err);
-#endif
-        if (!commands || err != CL_SUCCESS) {
-          die ("%s:%d: %s", __FILE__, __LINE__, errToStr(err));
+        /* pre 2.0 devices do not know this query; they simply have no SVM */
+        cl_device_svm_capabilities caps;
+        if (clGetDeviceInfo( device_id, CL_DEVICE_SVM_CAPABILITIES,
+                             sizeof (caps), &caps, NULL) == CL_SUCCESS) {
+          svm_coarse = (caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) != 0;
+          svm_fine = (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) != 0;
         }
+#endif
+        if (verbose)
+          printf( ">> SVM support: %s\n", (svm_fine ? "fine-grained"
+                                            : (svm_coarse ? "coarse-grained" : "none")));
+        /* 64-bit integers are optional in the embedded profile only */
+        char *exts = getDeviceStr( device_id, CL_DEVICE_EXTENSIONS);
+        char *profile = getDeviceStr( device_id, CL_DEVICE_PROFILE);
+        has_fp16 = (strstr( exts, "cl_khr_fp16") != NULL);
+        has_int64 = (strcmp( profile, "FULL_PROFILE") == 0)
+                    || (strstr( exts, "cles_khr_int64") != NULL);
+        free( exts);
+        free( profile);
+        if (verbose)
+          printf( ">> half support: %s, 64-bit integer support: %s\n",
+                  (has_fp16 ? "yes" : "no"), (has_int64 ? "yes" : "no"));
       }
     }
   }
@@ -308,13 +624,17 @@ cl_int initGPU ()
 
 cl_int initCPUVerbose ()
 {
+#ifndef SIMPLE_NO_INSTR
   verbose = true;
+#endif
   return initDevice( CL_DEVICE_TYPE_CPU);
 }
 
 cl_int initGPUVerbose ()
 {
+#ifndef SIMPLE_NO_INSTR
   verbose = true;
+#endif
   return initDevice( CL_DEVICE_TYPE_GPU);
 }
 
@@ -323,241 +643,2370 @@ size_t maxWorkItems( int dim)
    return getDeviceMaxWorkItems( device_id, dim);
 }
 
-cl_mem allocDev( size_t n)
+static int newMemEntry()
 {
-   cl_int err = CL_SUCCESS;
-   cl_mem mem;
+   int id;
 
-   if (verbose)
-     printf( "allocating %s on the device\n", getMemStr( n));
-   mem = clCreateBuffer (context, CL_MEM_READ_WRITE, n, NULL, &err);
-   if( err != CL_SUCCESS || mem == NULL)
-      die ("%s:%d: %s", __FILE__, __LINE__, errToStr(err));
+   for( id=0; id< num_mem_entries; id++) {
+     if (!mem_table[id].in_use)
+       break;
+   }
+   if (id == num_mem_entries) {
+     num_mem_entries = (num_mem_entries == 0 ? 16 : 2*num_mem_entries);
+     mem_table = (mem_entry *)realloc( mem_table,
+                                       sizeof( mem_entry)*num_mem_entries);
+     if (mem_table == NULL)
+       die ("Error: failed to allocate memory for %d memory entries", num_mem_entries);
+     for( int i=id; i< num_mem_entries; i++)
+       mem_table[i].in_use = false;
+   }
+   mem_table[id].in_use = true;
+   mem_table[id].spillable = false;
+   mem_table[id].buf = NULL;
+   mem_table[id].host_copy = NULL;
+   mem_table[id].size = 0;
+   mem_table[id].kernel = NULL;
+   mem_table[id].arg_idx = 0;
+   mem_table[id].last_use = mem_tick;
+   mem_table[id].captured = false;
+   mem_table[id].last_write = NULL;
+   mem_table[id].reads = NULL;
+   mem_table[id].num_reads = 0;
+   mem_table[id].max_reads = 0;
+
+   return id;
+}
 
-   return mem;
+static int findMemEntry( cl_mem buf)
+{
+   /* spilled entries have no buffer; NULL never denotes one of ours */
+   if (buf == NULL)
+     return -1;
+   for( int id=0; id< num_mem_entries; id++) {
+     if (mem_table[id].in_use && (mem_table[id].buf == buf))
+       return id;
+   }
+   return -1;
 }
 
-#define H2D( tname, t)                                                          \
-void host2dev ##tname ##Arr( t *a, cl_mem ad, size_t n)                         \
-{                                                                               \
-   clock_gettime( CLOCK_REALTIME, &start);                                      \
-   if (verbose)                                                                 \
-      printf( "transferring %s to device\n", getMemStr( sizeof (t) * n));       \
-   CL_SAFE(clEnqueueWriteBuffer( commands, ad, CL_TRUE, 0,                      \
-                               sizeof (t) * n,                                  \
-                               a, 0, NULL, NULL));                              \
-   clock_gettime( CLOCK_REALTIME, &stop);                                       \
-   num_h2d++;                                                                   \
-   h2d_time += (stop.tv_sec -start.tv_sec)*1000.0                               \
-               + (stop.tv_nsec -start.tv_nsec)/1000000.0;                       \
+/*
+ * Session capture: a capture file starts with CAPTURE_MAGIC followed by a
+ * sequence of records. Each record is a 32 bit tag followed by its fields;
+ * ids and sizes are stored as 32/64 bit integers in host byte order:
+ *
+ *   RecKernel  kernel-id source name options   (strings: 64 bit length + bytes)
+ *   RecAlloc   buffer-id size
+ *   RecFree    buffer-id
+ *   RecH2D     buffer-id offset size data
+ *   RecD2H     buffer-id offset size
+ *   RecArgBuf  kernel-id arg-idx buffer-id
+ *   RecArgVal  kernel-id arg-idx size has-value [data]
+ *   RecLaunch  kernel-id dim has-offset [offset] global has-local [local]
+ *   RecBatch   sync-every
+ *   RecSync
+ *   RecUnbatch
+ *
+ * Buffer ids are indices into the memory table; they stay valid across
+ * spills and restores.
+ */
+#define CAPTURE_MAGIC "OCLSCAP1"
+
+typedef enum {
+  RecKernel = 1,
+  RecAlloc,
+  RecFree,
+  RecH2D,
+  RecD2H,
+  RecArgBuf,
+  RecArgVal,
+  RecLaunch,
+  RecBatch,
+  RecSync,
+  RecUnbatch
+} capture_rec;
+
+static void capBytes( const void *p, size_t n)
+{
+  if (fwrite( p, 1, n, capture_file) != n)
+    die ("Error: failed to write %s to the capture file", getMemStr( n));
 }
 
-H2D( Double, double)
-H2D( Float, float)
-H2D( Int, int)
-H2D( Bool, bool)
+static void capU32( uint32_t v)
+{
+  capBytes( &v, sizeof (v));
+}
 
-#define D2H( tname, t)                                                         \
-void dev2host ##tname ##Arr( cl_mem ad, t* a, size_t n)                        \
-{                                                                              \
-   clock_gettime( CLOCK_REALTIME, &start);                                     \
-   if (verbose)                                                                \
-      printf( "transferring %s to host\n", getMemStr( sizeof (t) * n));        \
-   CL_SAFE(clEnqueueReadBuffer( commands, ad, CL_TRUE, 0,                      \
-                              sizeof (t) * n,                                  \
-                              a, 0, NULL, NULL));                              \
-   clock_gettime( CLOCK_REALTIME, &stop);                                      \
-   num_d2h++;                                                                  \
-   d2h_time += (stop.tv_sec -start.tv_sec)*1000.0                              \
-               + (stop.tv_nsec -start.tv_nsec)/1000000.0;                      \
+static void capU64( uint64_t v)
+{
+  capBytes( &v, sizeof (v));
 }
 
-D2H( Double, double)
-D2H( Float, float)
-D2H( Int, int)
-D2H( Bool, bool)
+static void capStr( const char *str)
+{
+  size_t n = (str == NULL ? 0 : strlen( str));
+  capU64( n);
+  if (n > 0)
+    capBytes( str, n);
+}
 
+static uint32_t capKernelId( cl_kernel kernel)
+{
+  for( int i=0; i< num_capture_kernels; i++) {
+    if (capture_kernels[i] == kernel)
+      return i;
+  }
+  die ("Error: a kernel used during capture was created before startCapture!");
+  return 0;
+}
 
-cl_kernel createKernel( const char *kernel_source, char *kernel_name)
+static uint32_t capBufferId( cl_mem buf)
 {
-  cl_kernel kernel = NULL;
-  cl_int err = CL_SUCCESS;
+  int id = findMemEntry( buf);
+  if ((id == -1) || !mem_table[id].captured)
+    die ("Error: a buffer used during capture was allocated before startCapture!");
+  return id;
+}
 
-  /* Create the compute program from the source buffer.  */
-  program = clCreateProgramWithSource (context, 1,
-                                       (const char **) &kernel_source,
-                                       NULL, &err);
-  if (!program || err != CL_SUCCESS) {
-    die ("%s:%d: %s\n", __FILE__, __LINE__, errToStr(err));
+static void captureKernel( cl_kernel kernel, const char *source,
+                           const char *name, const char *options)
+{
+  capture_kernels = (cl_kernel *)realloc( capture_kernels,
+                                          sizeof( cl_kernel)*(num_capture_kernels+1));
+  if (capture_kernels == NULL)
+    die ("Error: failed to allocate memory for captured kernels");
+  capture_kernels[num_capture_kernels] = kernel;
+  capU32( RecKernel);
+  capU32( num_capture_kernels++);
+  capStr( source);
+  capStr( name);
+  capStr( options);
+}
+
+static void captureAlloc( int id)
+{
+  mem_table[id].captured = true;
+  capU32( RecAlloc);
+  capU32( id);
+  capU64( mem_table[id].size);
+}
+
+static void captureArg( cl_kernel kernel, cl_uint idx, size_t size, const void *val)
+{
+  int id = -1;
+
+  if ((size == sizeof (cl_mem)) && (val != NULL))
+    id = findMemEntry( *(cl_mem *)val);
+  if (id != -1) {
+    capU32( RecArgBuf);
+    capU32( capKernelId( kernel));
+    capU32( idx);
+    capU32( capBufferId( *(cl_mem *)val));
+  } else {
+    capU32( RecArgVal);
+    capU32( capKernelId( kernel));
+    capU32( idx);
+    capU64( size);
+    capU32( val != NULL);
+    if (val != NULL)
+      capBytes( val, size);
   }
+}
 
-  /* Build the program executable.  */
-  err = clBuildProgram (program, 0, NULL, NULL, NULL, NULL);
-  if (err != CL_SUCCESS)
-    {
-      size_t len;
-      char buffer[2048];
+static void captureLaunch( cl_kernel kernel, int dim, size_t *offset,
+                           size_t *global, size_t *local)
+{
+  capU32( RecLaunch);
+  capU32( capKernelId( kernel));
+  capU32( dim);
+  capU32( offset != NULL);
+  for( int i=0; (offset != NULL) && (i<dim); i++)
+    capU64( offset[i]);
+  for( int i=0; i<dim; i++)
+    capU64( global[i]);
+  capU32( local != NULL);
+  for( int i=0; (local != NULL) && (i<dim); i++)
+    capU64( local[i]);
+}
 
-      clGetProgramBuildInfo (program, device_id, CL_PROGRAM_BUILD_LOG,
-                             sizeof (buffer), buffer, &len);
-      die ("Error: Failed to build program executable!\n%s", buffer);
-    }
+/* records a transfer of n bytes at offset; the data only for uploads */
+static void captureTransfer( bool to_dev, cl_mem ad, void *a, size_t offset, size_t n)
+{
+  capU32( to_dev ? RecH2D : RecD2H);
+  capU32( capBufferId( ad));
+  capU64( offset);
+  capU64( n);
+  if (to_dev)
+    capBytes( (char *)a + offset, n);
+}
 
-  /* Create the compute kernel in the program.  */
-  kernel = clCreateKernel (program, kernel_name, &err);
-  if (!kernel || err != CL_SUCCESS) {
-    die ("Error: Failed to create compute kernel!");
-    kernel = NULL;
+void startCapture( const char *fname)
+{
+  if (capture_file != NULL)
+    die ("Error: startCapture called while a capture is already running!");
+  capture_file = fopen( fname, "wb");
+  if (capture_file == NULL)
+    die ("Error: cannot open capture file \"%s\"!", fname);
+  capBytes( CAPTURE_MAGIC, strlen( CAPTURE_MAGIC));
+  if (verbose)
+    printf( "capturing the session to \"%s\"\n", fname);
+}
+
+void stopCapture()
+{
+  if (capture_file != NULL) {
+    if (fclose( capture_file) != 0)
+      die ("Error: failed to close the capture file");
+    capture_file = NULL;
+    free( capture_kernels);
+    capture_kernels = NULL;
+    num_capture_kernels = 0;
+    for( int id=0; id< num_mem_entries; id++)
+      mem_table[id].captured = false;
   }
-  return kernel;
 }
 
-#define SETUPARG( tname, t)                                                      \
-case tname ## Arr:                                                               \
-   kernel_args[i].num_elems = va_arg(ap, int);                                   \
-   kernel_args[i].t##_host_buf = va_arg(ap, t *);                                \
-   kernel_args[i].dev_buf = allocDev ( sizeof (t) * kernel_args[i].num_elems);   \
-   host2dev ## tname ## Arr ( kernel_args[i].t##_host_buf,                       \
-                              kernel_args[i].dev_buf, kernel_args[i].num_elems); \
-   CL_SAFE(clSetKernelArg (kernel, i, sizeof (cl_mem), &kernel_args[i].dev_buf);)\
-break;
+/*
+ * Dependency tracking for concurrent mode. depWaitList appends the events a
+ * command using buffer <id> has to wait for: the last write for reads, and
+ * additionally all reads since for writes.
+ */
+static void appendEvent( cl_event **list, int *num, int *max, cl_event ev)
+{
+  if (*num == *max) {
+    *max = (*max == 0 ? 8 : 2 * *max);
+    *list = (cl_event *)realloc( *list, sizeof( cl_event) * *max);
+    if (*list == NULL)
+      die ("Error: failed to allocate memory for %d events", *max);
+  }
+  (*list)[(*num)++] = ev;
+}
 
-cl_kernel setupKernel( const char *kernel_source, char *kernel_name, int num_args, ...)
+static void depWaitList( int id, bool write, cl_event **list, int *num, int *max)
 {
-   cl_kernel kernel = NULL;
-   va_list ap;
-   int i;
+  mem_entry *e = &mem_table[id];
 
-   kernel = createKernel( kernel_source, kernel_name);
-   num_kernel_args = num_args;
-   va_start(ap, num_args);
-   for(i=0; (i<num_args) && (kernel != NULL); i++) {
-      kernel_args[i].arg_t =va_arg(ap, clarg_type);
-      switch( kernel_args[i].arg_t) {
-        SETUPARG( Double, double)
-        SETUPARG( Float, float)
-        SETUPARG( Int, int)
-        SETUPARG( Bool, bool)
-        case IntConst:
-          kernel_args[i].val = va_arg(ap, unsigned int);
-          CL_SAFE(clSetKernelArg (kernel, i, sizeof (unsigned int), &kernel_args[i].val));
-          break;
-        case FloatConst:
-          /* Promoted because va_arg pushes to stack */
-          kernel_args[i].valf = va_arg(ap, double);
-          CL_SAFE(clSetKernelArg (kernel, i, sizeof (float), &kernel_args[i].valf));
-          break;
-        case DoubleConst:
-          kernel_args[i].vald = va_arg(ap, double);
-          CL_SAFE(clSetKernelArg (kernel, i, sizeof (double), &kernel_args[i].vald));
-          break;
-        default:
-          die ("Error: illegal argument tag for executeKernel!");
-      }
-   }
-   va_end(ap);
+  if (e->last_write != NULL)
+    appendEvent( list, num, max, e->last_write);
+  for( int i=0; write && (i< e->num_reads); i++)
+    appendEvent( list, num, max, e->reads[i]);
+}
 
-   return kernel;
+static void depRecord( int id, bool write, cl_event ev)
+{
+  mem_entry *e = &mem_table[id];
+
+  CL_SAFE(clRetainEvent( ev));
+  if (write) {
+    if (e->last_write != NULL)
+      CL_SAFE(clReleaseEvent( e->last_write));
+    for( int i=0; i< e->num_reads; i++)
+      CL_SAFE(clReleaseEvent( e->reads[i]));
+    e->num_reads = 0;
+    e->last_write = ev;
+  } else {
+    appendEvent( &e->reads, &e->num_reads, &e->max_reads, ev);
+  }
 }
 
-cl_int launchKernel( cl_kernel kernel, int dim, size_t *global, size_t *local)
+/* drops the dependencies of buffer <id>; only legal once they completed */
+static void depClear( int id)
 {
-  cl_int err;
-  if (verbose) {
-    printf( "Trying to launch a kernel with global [ ");
-    for(int i=0; i<dim; i++) {
-      printf( "%zu ", global[i]);
-    }
-    printf( "] and local [ ");
-    for(int i=0; i<dim; i++) {
-      printf( "%zu ", local[i]);
-    }
-    printf( "]\n");
-  }
-  clock_gettime( CLOCK_REALTIME, &start);
-  if (CL_SUCCESS
-      != (err = clEnqueueNDRangeKernel (commands, kernel,
-                                 dim, NULL, global, local, 0, NULL, NULL))) {
-    if (!verbose) {
-      printf( "Tried launching kernel with global [ ");
-      for(int i=0; i<dim; i++) {
-        printf( "%zu ", global[i]);
-      }
-      printf( "] and local [ ");
-      for(int i=0; i<dim; i++) {
-        printf( "%zu ", local[i]);
-      }
-      printf( "]\n");
-    }
-    die ("Error: %s", errToStr(err));
+  mem_entry *e = &mem_table[id];
+
+  if (e->last_write != NULL)
+    CL_SAFE(clReleaseEvent( e->last_write));
+  e->last_write = NULL;
+  for( int i=0; i< e->num_reads; i++)
+    CL_SAFE(clReleaseEvent( e->reads[i]));
+  e->num_reads = 0;
+}
+
+static arg_access detectAccess( cl_kernel kernel, cl_uint idx)
+{
+#ifdef CL_VERSION_1_2
+  cl_kernel_arg_type_qualifier q;
+
+  /* only available if the program was built with -cl-kernel-arg-info */
+  if ((clGetKernelArgInfo( kernel, idx, CL_KERNEL_ARG_TYPE_QUALIFIER,
+                           sizeof (q), &q, NULL) == CL_SUCCESS)
+      && (q & CL_KERNEL_ARG_TYPE_CONST))
+    return AccessRead;
+#else
+  (void) kernel;
+  (void) idx;
+#endif
+  return AccessReadWrite;
+}
+
+/* binds argument <idx> to buffer <id>, to SVM (SVM_ARG) or unbinds it (-1) */
+static void bindMem( cl_kernel kernel, cl_uint idx, int id)
+{
+  int b;
+
+  for( b=0; b< num_bindings; b++) {
+    if ((bindings[b].kernel == kernel) && (bindings[b].idx == idx))
+      break;
+  }
+  if (id == -1) {
+    if (b < num_bindings)
+      bindings[b] = bindings[--num_bindings];
+    return;
   }
+  if (b == num_bindings) {
+    bindings = (arg_binding *)realloc( bindings, sizeof( arg_binding)*(num_bindings+1));
+    if (bindings == NULL)
+      die ("Error: failed to allocate memory for argument bindings");
+    num_bindings++;
+    bindings[b].kernel = kernel;
+    bindings[b].idx = idx;
+  }
+  /* a rebound argument starts over; setArgAccess applies to one binding */
+  bindings[b].access = detectAccess( kernel, idx);
+  bindings[b].mem_id = id;
+}
 
-  /* Wait for all commands to complete.  */
-  CL_SAFE(clFinish (commands));
-  clock_gettime( CLOCK_REALTIME, &stop);
-  num_kernel++;
-  kernel_time += (stop.tv_sec -start.tv_sec)*1000.0
-                  + (stop.tv_nsec -start.tv_nsec)/1000000.0;
+static void bindArg( cl_kernel kernel, cl_uint idx, size_t size, const void *val)
+{
+  int id = -1;
 
-  return CL_SUCCESS;
+  if ((size == sizeof (cl_mem)) && (val != NULL))
+    id = findMemEntry( *(cl_mem *)val);
+  bindMem( kernel, idx, id);
 }
 
-#define FETCH( tname, t)                                     \
-case tname ## Arr:                                           \
-   dev2host ## tname ## Arr ( kernel_args[i].dev_buf,        \
-                              kernel_args[i].t ## _host_buf, \
-                              kernel_args[i].num_elems);     \
-break;
+/*
+ * Kernel handles may be reused by the runtime once released; a new kernel
+ * must not inherit the bindings of a released one.
+ */
+static void dropBindings( cl_kernel kernel)
+{
+  for( int b=num_bindings-1; b>=0; b--) {
+    if (bindings[b].kernel == kernel)
+      bindings[b] = bindings[--num_bindings];
+  }
+}
 
-cl_int runKernel( cl_kernel kernel, int dim, size_t *global, size_t *local)
+void setArgAccess( cl_kernel kernel, cl_uint idx, arg_access access)
 {
-  cl_int err = CL_SUCCESS;
+  for( int b=0; b< num_bindings; b++) {
+    if ((bindings[b].kernel == kernel) && (bindings[b].idx == idx)
+        && (bindings[b].mem_id != SVM_ARG)) {
+      bindings[b].access = access;
+      return;
+    }
+  }
+  die ("Error: setArgAccess called for argument %u which is not a buffer"
+       " set through setKernelArg or setupKernel!", idx);
+}
 
-  launchKernel( kernel, dim, global, local);
+/* transfers on the in-order queue wait for the concurrent users of <ad> */
+static int transferDeps( cl_mem ad, bool to_dev, cl_event **list)
+{
+  int num = 0, max = 0;
+  int id;
 
-  for( int i=0; i< num_kernel_args; i++) {
-      switch( kernel_args[i].arg_t) {
-          FETCH( Double, double)
-          FETCH( Float, float)
-          FETCH( Int, int)
-          FETCH( Bool, bool)
-          case IntConst:
-              /* do nothing */
-              break;
-          case FloatConst:
-              /* do nothing */
-              break;
-          case DoubleConst:
-              /* do nothing */
-              break;
-          default:
-              die ("Error: illegal argument tag in runKernel!");
-              kernel = NULL;
-      }
+  *list = NULL;
+  if ((num_conc_queues > 0) && ((id = findMemEntry( ad)) != -1))
+    depWaitList( id, to_dev, list, &num, &max);
+  return num;
+}
+
+/* after a blocking transfer, the dependencies it waited for have completed */
+static void transferDone( cl_mem ad, bool to_dev, cl_event *list)
+{
+  int id;
+
+  if ((num_conc_queues > 0) && ((id = findMemEntry( ad)) != -1)) {
+    if (to_dev) {
+      depClear( id);
+    } else if (mem_table[id].last_write != NULL) {
+      CL_SAFE(clReleaseEvent( mem_table[id].last_write));
+      mem_table[id].last_write = NULL;
+    }
   }
+  free( list);
+}
 
-  return err;
+void setKernelArg( cl_kernel kernel, cl_uint idx, size_t size, const void *val)
+{
+  API_ENTER();
+  CL_SAFE(clSetKernelArg (kernel, idx, size, val));
+  if (num_conc_queues > 0)
+    bindArg( kernel, idx, size, val);
+  if (capture_file != NULL)
+    captureArg( kernel, idx, size, val);
+  API_LEAVE();
 }
 
-void printKernelTime()
+/*
+ * Spills the least recently used resident buffer that has not been used in
+ * the current tick. Returns false if there is no such buffer.
+ */
+static bool spillColdest()
 {
-  printf( "total time spent in %d kernel executions: %s\n", num_kernel, getTimeStr( kernel_time));
+   int victim = -1;
+
+   for( int id=0; id< num_mem_entries; id++) {
+     if (mem_table[id].in_use && mem_table[id].spillable
+         && (mem_table[id].buf != NULL) && (mem_table[id].last_use < mem_tick)
+         && ((victim == -1)
+             || (mem_table[id].last_use < mem_table[victim].last_use)))
+       victim = id;
+   }
+   if (victim == -1)
+     return false;
+   if (num_conc_queues > 0)
+     syncBatch();
+
+   mem_entry *e = &mem_table[victim];
+   if (verbose)
+     printf( "spilling %s from the device to the host\n", getMemStr( e->size));
+   e->host_copy = malloc( e->size);
+   if (e->host_copy == NULL)
+     die ("Error: failed to allocate %s for spilling a device buffer", getMemStr( e->size));
+   CL_SAFE(clEnqueueReadBuffer( commands, e->buf, CL_TRUE, 0, e->size,
+                                e->host_copy, 0, NULL, NULL));
+   CL_SAFE(clReleaseMemObject( e->buf));
+   e->buf = NULL;
+   mem_live -= e->size;
+   num_spills++;
+   spill_bytes += e->size;
+
+   return true;
 }
 
-void printTransferTimes()
+static cl_mem createBuffer( size_t n)
 {
-  printf( "total time spent in %d host to device transfers : %s\n", num_h2d, getTimeStr( h2d_time));
-  printf( "total time spent in %d device to host transfers : %s\n", num_d2h, getTimeStr( d2h_time));
+   cl_int err = CL_SUCCESS;
+   cl_mem mem;
+
+   while ((mem_live + n > mem_budget) && spillColdest())
+     ;
+   mem = clCreateBuffer (context, CL_MEM_READ_WRITE, n, NULL, &err);
+   while (((err == CL_MEM_OBJECT_ALLOCATION_FAILURE) || (err == CL_OUT_OF_RESOURCES))
+          && spillColdest()) {
+     mem = clCreateBuffer (context, CL_MEM_READ_WRITE, n, NULL, &err);
+   }
+   if( err != CL_SUCCESS || mem == NULL)
+      die ("%s:%d: %s", __FILE__, __LINE__, errToStr(err));
+   mem_live += n;
+
+   return mem;
 }
 
-cl_int freeDevice()
+static void restoreKernelMem( cl_kernel kernel)
 {
-  for( int i=0; i< num_kernel_args; i++) {
-    if( (kernel_args[i].arg_t == FloatArr)
-         || (kernel_args[i].arg_t == DoubleArr))
-      CL_SAFE(clReleaseMemObject (kernel_args[i].dev_buf));
+   mem_tick++;
+   for( int id=0; id< num_mem_entries; id++) {
+     if (mem_table[id].in_use && (mem_table[id].kernel == kernel))
+       mem_table[id].last_use = mem_tick;
+   }
+   for( int id=0; id< num_mem_entries; id++) {
+     mem_entry *e = &mem_table[id];
+     if (e->in_use && (e->kernel == kernel) && (e->buf == NULL)) {
+       if (verbose)
+         printf( "restoring %s from the host to the device\n", getMemStr( e->size));
+       e->buf = createBuffer( e->size);
+       CL_SAFE(clEnqueueWriteBuffer( commands, e->buf, CL_TRUE, 0, e->size,
+                                     e->host_copy, 0, NULL, NULL));
+       free( e->host_copy);
+       e->host_copy = NULL;
+       CL_SAFE(clSetKernelArg( kernel, e->arg_idx, sizeof (cl_mem), &e->buf));
+       num_restores++;
+     }
+   }
+}
+
+static int allocArg( cl_kernel kernel, int arg_idx, size_t n)
+{
+   int id;
+   cl_mem buf;
+
+   if (verbose)
+     printf( "allocating %s on the device\n", getMemStr( n));
+   buf = createBuffer( n);
+   id = newMemEntry();
+   mem_table[id].spillable = true;
+   mem_table[id].buf = buf;
+   mem_table[id].size = n;
+   mem_table[id].kernel = kernel;
+   mem_table[id].arg_idx = arg_idx;
+   if (capture_file != NULL)
+     captureAlloc( id);
+
+   return id;
+}
+
+cl_mem allocDev( size_t n)
+{
+   cl_mem mem;
+   int id;
+
+   if (verbose)
+     printf( "allocating %s on the device\n", getMemStr( n));
+   mem = createBuffer( n);
+   id = newMemEntry();
+   mem_table[id].buf = mem;
+   mem_table[id].size = n;
+   if (capture_file != NULL)
+     captureAlloc( id);
+
+   return mem;
+}
+
+static void releaseMemEntry( int id)
+{
+   mem_entry *e = &mem_table[id];
+
+   if ((capture_file != NULL) && e->captured) {
+     capU32( RecFree);
+     capU32( id);
+   }
+   depClear( id);
+   free( e->reads);
+   for( int b=num_bindings-1; b>=0; b--) {
+     if (bindings[b].mem_id == id)
+       bindings[b] = bindings[--num_bindings];
+   }
+   if (e->buf != NULL) {
+     mem_live -= e->size;
+     CL_SAFE(clReleaseMemObject( e->buf));
+   }
+   free( e->host_copy);
+   e->in_use = false;
+}
+
+void freeDev( cl_mem buf)
+{
+   int id = findMemEntry( buf);
+
+   if (id != -1)
+     releaseMemEntry( id);
+   else
+     CL_SAFE(clReleaseMemObject( buf));
+}
+
+/*
+ * Like the bindings, the buffers setupKernel allocated for a kernel must not
+ * outlive it: the runtime may hand out its handle again.
+ */
+static void dropKernelMem( cl_kernel kernel)
+{
+   for( int id=0; id< num_mem_entries; id++) {
+     if (mem_table[id].in_use && mem_table[id].spillable
+         && (mem_table[id].kernel == kernel))
+       releaseMemEntry( id);
+   }
+}
+
+void releaseKernel( cl_kernel kernel)
+{
+  dropBindings( kernel);
+  dropKernelMem( kernel);
+  CL_SAFE(clReleaseKernel (kernel));
+}
+
+void setMemBudget( size_t bytes)
+{
+   mem_budget = bytes;
+   mem_budget_set = true;
+}
+
+size_t getMemLive()
+{
+   return mem_live;
+}
+
+bool hasFp16()
+{
+   return has_fp16;
+}
+
+bool hasInt64()
+{
+   return has_int64;
+}
+
+bool hasSVM()
+{
+   return svm_coarse || svm_fine;
+}
+
+bool hasFineGrainSVM()
+{
+   return svm_fine;
+}
+
+static int findSVMEntry( void *p)
+{
+   for( int i=0; i< num_svm; i++) {
+     if (svm_table[i].ptr == p)
+       return i;
+   }
+   return -1;
+}
+
+static void mapSVMEntry( int i)
+{
+#ifdef CL_VERSION_2_0
+   if (!svm_fine && !svm_table[i].mapped) {
+     CL_SAFE(clEnqueueSVMMap( commands, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                              svm_table[i].ptr, svm_table[i].size, 0, NULL, NULL));
+     svm_table[i].mapped = true;
+   }
+#else
+   (void) i;
+#endif
+}
+
+/* returns true iff an unmap has been enqueued */
+static bool unmapSVMEntry( int i)
+{
+#ifdef CL_VERSION_2_0
+   if (!svm_fine && svm_table[i].mapped) {
+     CL_SAFE(clEnqueueSVMUnmap( commands, svm_table[i].ptr, 0, NULL, NULL));
+     svm_table[i].mapped = false;
+     return true;
+   }
+#else
+   (void) i;
+#endif
+   return false;
+}
+
+void *allocSVM( size_t n)
+{
+   void *p = NULL;
+
+   if (!hasSVM())
+     die ("Error: allocSVM called but the device does not support SVM!");
+   if (verbose)
+     printf( "allocating %s of %s SVM\n", getMemStr( n),
+             (svm_fine ? "fine-grained" : "coarse-grained"));
+   while ((mem_live + n > mem_budget) && spillColdest())
+     ;
+#ifdef CL_VERSION_2_0
+   p = clSVMAlloc( context,
+                   CL_MEM_READ_WRITE | (svm_fine ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0),
+                   n, 0);
+#endif
+   if (p == NULL)
+     die ("Error: failed to allocate %s of SVM", getMemStr( n));
+   mem_live += n;
+
+   if (num_svm == max_svm) {
+     max_svm = (max_svm == 0 ? 16 : 2*max_svm);
+     svm_table = (svm_entry *)realloc( svm_table, sizeof( svm_entry)*max_svm);
+     if (svm_table == NULL)
+       die ("Error: failed to allocate memory for %d SVM entries", max_svm);
+   }
+   svm_table[num_svm].ptr = p;
+   svm_table[num_svm].size = n;
+   svm_table[num_svm].mapped = false;
+   mapSVMEntry( num_svm);
+   num_svm++;
+
+   return p;
+}
+
+void freeSVM( void *p)
+{
+   int i = findSVMEntry( p);
+
+   if (i == -1)
+     die ("Error: freeSVM called with a pointer not obtained from allocSVM!");
+#ifdef CL_VERSION_2_0
+   unmapSVMEntry( i);
+   /* launches using SVM are serialised, so the last one covers them all */
+   if (svm_last != NULL)
+     CL_SAFE(clWaitForEvents( 1, &svm_last));
+   CL_SAFE(clFinish( commands));
+   clSVMFree( context, p);
+#endif
+   mem_live -= svm_table[i].size;
+   svm_table[i] = svm_table[--num_svm];
+}
+
+void mapSVM()
+{
+   bool unmapped = false;
+
+   for( int i=0; i< num_svm; i++)
+     unmapped = unmapped || !svm_table[i].mapped;
+   /*
+    * The maps are enqueued on "commands"; in concurrent mode, launches using
+    * the SVM may still be running on the other queues.
+    */
+   for( int q=0; unmapped && !svm_fine && (q< num_conc_queues); q++)
+     CL_SAFE(clFinish (conc_queues[q]));
+   for( int i=0; i< num_svm; i++)
+     mapSVMEntry( i);
+}
+
+static bool unmapAllSVM()
+{
+   bool unmapped = false;
+
+   for( int i=0; i< num_svm; i++)
+     unmapped = unmapSVMEntry( i) || unmapped;
+   return unmapped;
+}
+
+void unmapSVM()
+{
+   unmapAllSVM();
+}
+
+static void *mapPinned( cl_mem *buf, size_t n)
+{
+   cl_int err;
+   void *p;
+
+   *buf = clCreateBuffer( context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                          n, NULL, &err);
+   if (err != CL_SUCCESS)
+     die ("Error: failed to allocate %s of pinned host memory", getMemStr( n));
+   p = clEnqueueMapBuffer( commands, *buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                           0, n, 0, NULL, NULL, &err);
+   if (err != CL_SUCCESS)
+     die ("%s:%d: %s", __FILE__, __LINE__, errToStr(err));
+   return p;
+}
+
+static void unmapPinned( cl_mem buf, void *p)
+{
+   CL_SAFE(clEnqueueUnmapMemObject( commands, buf, p, 0, NULL, NULL));
+   CL_SAFE(clFinish( commands));
+   CL_SAFE(clReleaseMemObject( buf));
+}
+
+void *allocPinned( size_t n)
+{
+   if (verbose)
+     printf( "allocating %s of pinned host memory\n", getMemStr( n));
+   if (num_pinned == max_pinned) {
+     max_pinned = (max_pinned == 0 ? 16 : 2*max_pinned);
+     pinned_table = (pinned_entry *)realloc( pinned_table,
+                                             sizeof( pinned_entry)*max_pinned);
+     if (pinned_table == NULL)
+       die ("Error: failed to allocate memory for %d pinned entries", max_pinned);
+   }
+   pinned_table[num_pinned].ptr = mapPinned( &pinned_table[num_pinned].buf, n);
+   pinned_table[num_pinned].size = n;
+
+   return pinned_table[num_pinned++].ptr;
+}
+
+void freePinned( void *p)
+{
+   for( int i=0; i< num_pinned; i++) {
+     if (pinned_table[i].ptr == p) {
+       unmapPinned( pinned_table[i].buf, p);
+       pinned_table[i] = pinned_table[--num_pinned];
+       return;
+     }
+   }
+   die ("Error: freePinned called with a pointer not obtained from allocPinned!");
+}
+
+void setStagingThreshold( size_t bytes)
+{
+   staging_threshold = bytes;
+   staging_threshold_set = true;
+}
+
+static bool isPinned( const void *p, size_t n)
+{
+   const char *c = (const char *)p;
+
+   for( int i=0; i< num_pinned; i++) {
+     const char *start = (const char *)pinned_table[i].ptr;
+     if ((c >= start) && (n <= pinned_table[i].size)
+         && ((size_t)(c - start) <= pinned_table[i].size - n))
+       return true;
+   }
+   return false;
+}
+
+static xfer_kind transferKind( const void *p, size_t n)
+{
+   if (isPinned( p, n))
+     return XferPinned;
+   return (n >= staging_threshold ? XferStaged : XferPageable);
+}
+
+static const char *xferStr( xfer_kind kind)
+{
+   return (kind == XferPinned ? "pinned" : (kind == XferStaged ? "staged" : "pageable"));
+}
+
+static void initStaging()
+{
+   if (!staging_ready) {
+     for( int i=0; i< STAGING_SLOTS; i++)
+       staging_ptr[i] = mapPinned( &staging_buf[i], STAGING_CHUNK);
+     staging_ready = true;
+   }
+}
+
+/*
+ * Staged transfers: only the first chunk waits for <deps>; the remaining ones
+ * are ordered behind it by the in-order queue "commands".
+ */
+static void stagedWrite( char *a, cl_mem ad, size_t offset, size_t n,
+                         int num_deps, cl_event *deps)
+{
+   cl_event ev[STAGING_SLOTS] = { NULL };
+   int slot = 0;
+
+   initStaging();
+   for( size_t done = 0; done < n; done += STAGING_CHUNK) {
+     size_t len = (n - done < STAGING_CHUNK ? n - done : STAGING_CHUNK);
+     if (ev[slot] != NULL) {
+       CL_SAFE(clWaitForEvents( 1, &ev[slot]));
+       CL_SAFE(clReleaseEvent( ev[slot]));
+     }
+     memcpy( staging_ptr[slot], a + offset + done, len);
+     CL_SAFE(clEnqueueWriteBuffer( commands, ad, CL_FALSE, offset + done, len,
+                                   staging_ptr[slot], (done == 0 ? num_deps : 0),
+                                   (done == 0 ? deps : NULL), &ev[slot]));
+     CL_SAFE(clFlush( commands));
+     slot = (slot+1) % STAGING_SLOTS;
+   }
+   for( int i=0; i< STAGING_SLOTS; i++) {
+     if (ev[i] != NULL) {
+       CL_SAFE(clWaitForEvents( 1, &ev[i]));
+       CL_SAFE(clReleaseEvent( ev[i]));
+     }
+   }
+}
+
+static void stagedRead( cl_mem ad, char *a, size_t offset, size_t n,
+                        int num_deps, cl_event *deps)
+{
+   cl_event ev[STAGING_SLOTS] = { NULL };
+   size_t pos[STAGING_SLOTS], len[STAGING_SLOTS];
+   size_t issued = 0, done = 0;
+   int slot = 0, next = 0;
+
+   initStaging();
+   while (done < n) {
+     /* keep all slots busy */
+     while ((issued < n) && (ev[next] == NULL)) {
+       pos[next] = issued;
+       len[next] = (n - issued < STAGING_CHUNK ? n - issued : STAGING_CHUNK);
+       CL_SAFE(clEnqueueReadBuffer( commands, ad, CL_FALSE, offset + issued,
+                                    len[next], staging_ptr[next],
+                                    (issued == 0 ? num_deps : 0),
+                                    (issued == 0 ? deps : NULL), &ev[next]));
+       issued += len[next];
+       next = (next+1) % STAGING_SLOTS;
+     }
+     CL_SAFE(clFlush( commands));
+     CL_SAFE(clWaitForEvents( 1, &ev[slot]));
+     CL_SAFE(clReleaseEvent( ev[slot]));
+     ev[slot] = NULL;
+     memcpy( a + offset + pos[slot], staging_ptr[slot], len[slot]);
+     done += len[slot];
+     slot = (slot+1) % STAGING_SLOTS;
+   }
+}
+
+static void accountTransfer( bool to_dev, xfer_kind kind, size_t n)
+{
+   double time = (stop.tv_sec -start.tv_sec)*1000.0
+                 + (stop.tv_nsec -start.tv_nsec)/1000000.0;
+
+   if (to_dev) {
+     num_h2d++;
+     h2d_time += time;
+   } else {
+     num_d2h++;
+     d2h_time += time;
+   }
+   xfer_bytes[kind] += n;
+   xfer_time[kind] += time;
+}
+
+void host2devBytes( void *a, cl_mem ad, size_t offset, size_t n)
+{
+   API_ENTER();
+   xfer_kind kind = transferKind( (char *)a + offset, n);
+
+   if (capture_file != NULL)
+      captureTransfer( true, ad, a, offset, n);
+   TIMER_START();
+   if (verbose)
+      printf( "transferring %s to device (%s)\n", getMemStr( n), xferStr( kind));
+   cl_event *deps;
+   int num_deps = transferDeps( ad, true, &deps);
+   if (kind == XferStaged) {
+     stagedWrite( (char *)a, ad, offset, n, num_deps, deps);
+   } else {
+     CL_SAFE(clEnqueueWriteBuffer( commands, ad, CL_TRUE, offset, n,
+                                   (char *)a + offset, num_deps, deps, NULL));
+   }
+   transferDone( ad, true, deps);
+   TIMER_STOP();
+   accountTransfer( true, kind, n);
+   API_LEAVE();
+}
+
+void dev2hostBytes( cl_mem ad, void *a, size_t offset, size_t n)
+{
+   API_ENTER();
+   xfer_kind kind = transferKind( (char *)a + offset, n);
+
+   if (capture_file != NULL)
+      captureTransfer( false, ad, a, offset, n);
+   TIMER_START();
+   if (verbose)
+      printf( "transferring %s to host (%s)\n", getMemStr( n), xferStr( kind));
+   cl_event *deps;
+   int num_deps = transferDeps( ad, false, &deps);
+   if (kind == XferStaged) {
+     stagedRead( ad, (char *)a, offset, n, num_deps, deps);
+   } else {
+     CL_SAFE(clEnqueueReadBuffer( commands, ad, CL_TRUE, offset, n,
+                                  (char *)a + offset, num_deps, deps, NULL));
+   }
+   transferDone( ad, false, deps);
+   TIMER_STOP();
+   accountTransfer( false, kind, n);
+   API_LEAVE();
+}
+
+/*
+ * Rectangular transfers; "org" and "reg" are in bytes for the first axis
+ * and host and device use the same origin and pitches. They are never staged.
+ */
+static void transferRect( bool to_dev, void *a, cl_mem ad, size_t *org,
+                          size_t *reg, size_t row_pitch, size_t slice_pitch)
+{
+   /* an empty region transfers nothing; org+reg-1 below would underflow */
+   if ((reg[0] == 0) || (reg[1] == 0) || (reg[2] == 0))
+     return;
+   API_ENTER();
+   size_t first = org[2] * slice_pitch + org[1] * row_pitch + org[0];
+   size_t last = (org[2]+reg[2]-1) * slice_pitch + (org[1]+reg[1]-1) * row_pitch
+                 + org[0] + reg[0];
+   xfer_kind kind = (isPinned( (char *)a + first, last - first) ? XferPinned
+                                                                 : XferPageable);
+
+   /* captured row by row so that replay only needs linear transfers */
+   for( size_t z=0; (capture_file != NULL) && (z < reg[2]); z++) {
+     for( size_t y=0; y < reg[1]; y++) {
+       captureTransfer( to_dev, ad, a, (org[2]+z) * slice_pitch
+                                       + (org[1]+y) * row_pitch + org[0], reg[0]);
+     }
+   }
+   TIMER_START();
+   if (verbose)
+      printf( "transferring %s to %s (%s)\n", getMemStr( reg[0] * reg[1] * reg[2]),
+                                             (to_dev ? "device" : "host"), xferStr( kind));
+   cl_event *deps;
+   int num_deps = transferDeps( ad, to_dev, &deps);
+   if (to_dev) {
+     CL_SAFE(clEnqueueWriteBufferRect( commands, ad, CL_TRUE, org, org, reg,
+                                       row_pitch, slice_pitch,
+                                       row_pitch, slice_pitch,
+                                       a, num_deps, deps, NULL));
+   } else {
+     CL_SAFE(clEnqueueReadBufferRect( commands, ad, CL_TRUE, org, org, reg,
+                                      row_pitch, slice_pitch,
+                                      row_pitch, slice_pitch,
+                                      a, num_deps, deps, NULL));
+   }
+   transferDone( ad, to_dev, deps);
+   TIMER_STOP();
+   accountTransfer( to_dev, kind, reg[0] * reg[1] * reg[2]);
+   API_LEAVE();
+}
+
+#define H2D( tname, t)                                                          \
+void host2dev ##tname ##Arr( t *a, cl_mem ad, size_t n)                         \
+{                                                                               \
+   host2devBytes( a, ad, 0, sizeof (t) * n);                                    \
+}                                                                               \
+                                                                                \
+void host2dev ##tname ##ArrRange( t *a, cl_mem ad, size_t offset, size_t n)     \
+{                                                                               \
+   host2devBytes( a, ad, sizeof (t) * offset, sizeof (t) * n);                  \
+}                                                                               \
+                                                                                \
+void host2dev ##tname ##ArrRect( t *a, cl_mem ad, size_t *origin,               \
+                                 size_t *region, size_t row_len,                \
+                                 size_t num_rows)                               \
+{                                                                               \
+   size_t org[3] = { origin[0] * sizeof (t), origin[1], origin[2] };            \
+   size_t reg[3] = { region[0] * sizeof (t), region[1], region[2] };            \
+                                                                                \
+   transferRect( true, a, ad, org, reg, sizeof (t) * row_len,                   \
+                 sizeof (t) * row_len * num_rows);                              \
+}
+
+H2D( Double, double)
+H2D( Float, float)
+H2D( Int, int)
+H2D( Bool, bool)
+H2D( Half, cl_half)
+H2D( Char, cl_char)
+H2D( UChar, cl_uchar)
+H2D( Short, cl_short)
+H2D( UShort, cl_ushort)
+H2D( Long, cl_long)
+H2D( ULong, cl_ulong)
+
+#define D2H( tname, t)                                                         \
+void dev2host ##tname ##Arr( cl_mem ad, t* a, size_t n)                        \
+{                                                                              \
+   dev2hostBytes( ad, a, 0, sizeof (t) * n);                                   \
+}                                                                              \
+                                                                               \
+void dev2host ##tname ##ArrRange( cl_mem ad, t* a, size_t offset, size_t n)    \
+{                                                                              \
+   dev2hostBytes( ad, a, sizeof (t) * offset, sizeof (t) * n);                 \
+}                                                                              \
+                                                                               \
+void dev2host ##tname ##ArrRect( cl_mem ad, t* a, size_t *origin,              \
+                                 size_t *region, size_t row_len,               \
+                                 size_t num_rows)                              \
+{                                                                              \
+   size_t org[3] = { origin[0] * sizeof (t), origin[1], origin[2] };           \
+   size_t reg[3] = { region[0] * sizeof (t), region[1], region[2] };           \
+                                                                               \
+   transferRect( false, a, ad, org, reg, sizeof (t) * row_len,                 \
+                 sizeof (t) * row_len * num_rows);                             \
+}
+
+D2H( Double, double)
+D2H( Float, float)
+D2H( Int, int)
+D2H( Bool, bool)
+D2H( Half, cl_half)
+D2H( Char, cl_char)
+D2H( UChar, cl_uchar)
+D2H( Short, cl_short)
+D2H( UShort, cl_ushort)
+D2H( Long, cl_long)
+D2H( ULong, cl_ulong)
+
+
+/*
+ * Builds <kernel_source> with <options> (may be NULL) into a new program that
+ * is returned in <prog> and creates the kernel <kernel_name> from it.
+ */
+static cl_kernel buildKernel( const char *kernel_source, const char *kernel_name,
+                              const char *options, cl_program *prog)
+{
+  cl_kernel kernel = NULL;
+  cl_int err = CL_SUCCESS;
+
+  /* Create the compute program from the source buffer.  */
+  *prog = clCreateProgramWithSource (context, 1,
+                                     (const char **) &kernel_source,
+                                     NULL, &err);
+  if (!*prog || err != CL_SUCCESS) {
+    die ("%s:%d: %s\n", __FILE__, __LINE__, errToStr(err));
+  }
+
+  /* Build the program executable.  */
+  err = clBuildProgram (*prog, 0, NULL, options, NULL, NULL);
+  if (err != CL_SUCCESS)
+    {
+      size_t len;
+      char buffer[2048];
+
+      clGetProgramBuildInfo (*prog, device_id, CL_PROGRAM_BUILD_LOG,
+                             sizeof (buffer), buffer, &len);
+      die ("Error: Failed to build program executable!\n%s", buffer);
+    }
+
+  /* Create the compute kernel in the program.  */
+  kernel = clCreateKernel (*prog, kernel_name, &err);
+  if (!kernel || err != CL_SUCCESS) {
+    die ("Error: Failed to create compute kernel!");
+    kernel = NULL;
+  }
+  dropBindings( kernel);
+  dropKernelMem( kernel);
+  return kernel;
+}
+
+cl_kernel createKernelWithProgram( const char *kernel_source, char *kernel_name,
+                                   cl_program *prog)
+{
+  cl_kernel kernel = buildKernel( kernel_source, kernel_name, NULL, prog);
+
+  if (capture_file != NULL)
+    captureKernel( kernel, kernel_source, kernel_name, NULL);
+  return kernel;
+}
+
+cl_kernel createKernel( const char *kernel_source, char *kernel_name)
+{
+  return createKernelWithProgram( kernel_source, kernel_name, &program);
+}
+
+static void *buildThread( void *arg)
+{
+  build_handle *b = (build_handle *)arg;
+  cl_int err;
+
+  err = clBuildProgram (b->program, 1, &device_id, b->options, NULL, NULL);
+  pthread_mutex_lock( &b->lock);
+  b->err = err;
+  b->done = true;
+  pthread_mutex_unlock( &b->lock);
+
+  return NULL;
+}
+
+build_handle *startBuild( const char *kernel_source, const char *options)
+{
+  cl_int err = CL_SUCCESS;
+  build_handle *b;
+
+  b = (build_handle *)malloc( sizeof( build_handle));
+  if (b == NULL)
+    die ("Error: failed to allocate memory for a build handle");
+  b->program = clCreateProgramWithSource (context, 1,
+                                          (const char **) &kernel_source,
+                                          NULL, &err);
+  if (!b->program || err != CL_SUCCESS) {
+    die ("%s:%d: %s\n", __FILE__, __LINE__, errToStr(err));
+  }
+  b->source = strdup( kernel_source);
+  b->options = (options == NULL ? NULL : strdup( options));
+  b->done = false;
+  b->joined = false;
+  b->err = CL_SUCCESS;
+  pthread_mutex_init( &b->lock, NULL);
+  if (pthread_create( &b->thread, NULL, buildThread, b) != 0)
+    die ("Error: failed to start a build thread");
+  if (verbose)
+    printf( "started building a program in the background\n");
+
+  return b;
+}
+
+bool buildDone( build_handle *b)
+{
+  bool done;
+
+  pthread_mutex_lock( &b->lock);
+  done = b->done;
+  pthread_mutex_unlock( &b->lock);
+
+  return done;
+}
+
+cl_program waitBuild( build_handle *b)
+{
+  if (!b->joined) {
+    pthread_join( b->thread, NULL);
+    b->joined = true;
+  }
+  if (b->err != CL_SUCCESS)
+    {
+      size_t len;
+      char buffer[2048];
+
+      clGetProgramBuildInfo (b->program, device_id, CL_PROGRAM_BUILD_LOG,
+                             sizeof (buffer), buffer, &len);
+      die ("Error: Failed to build program executable!\n%s", buffer);
+    }
+  return b->program;
+}
+
+cl_kernel createKernelFromBuild( build_handle *b, char *kernel_name)
+{
+  cl_kernel kernel = NULL;
+  cl_int err = CL_SUCCESS;
+
+  kernel = clCreateKernel (waitBuild( b), kernel_name, &err);
+  if (!kernel || err != CL_SUCCESS) {
+    die ("Error: Failed to create compute kernel!");
+    kernel = NULL;
+  }
+  dropBindings( kernel);
+  dropKernelMem( kernel);
+  if (capture_file != NULL)
+    captureKernel( kernel, b->source, kernel_name, b->options);
+  return kernel;
+}
+
+void freeBuild( build_handle *b)
+{
+  if (!b->joined)
+    pthread_join( b->thread, NULL);
+  pthread_mutex_destroy( &b->lock);
+  CL_SAFE(clReleaseProgram (b->program));
+  free( b->source);
+  free( b->options);
+  free( b);
+}
+
+/* rejects element types the device cannot handle */
+static void checkArrType( clarg_type type)
+{
+   if ((type == HalfArr) && !has_fp16)
+     die ("Error: HalfArr arguments require a device supporting cl_khr_fp16!");
+   if (((type == LongArr) || (type == ULongArr)) && !has_int64)
+     die ("Error: LongArr and ULongArr arguments require a device supporting"
+          " 64-bit integers (cles_khr_int64)!");
+}
+
+#define SETUPARG( tname, t)                                                      \
+case tname ## Arr:                                                               \
+   checkArrType( tname ## Arr);                                                  \
+   kernel_args[i].num_elems = readCount( wide, ap);                              \
+   kernel_args[i].t##_host_buf = va_arg(*ap, t *);                               \
+   kernel_args[i].mem_id = allocArg ( kernel, i,                                 \
+                                      sizeof (t) * kernel_args[i].num_elems);    \
+   host2dev ## tname ## Arr ( kernel_args[i].t##_host_buf,                       \
+                              mem_table[kernel_args[i].mem_id].buf,              \
+                              kernel_args[i].num_elems);                         \
+   setKernelArg (kernel, i, sizeof (cl_mem),                                     \
+                 &mem_table[kernel_args[i].mem_id].buf);                         \
+break;
+
+/*
+ * Array lengths are passed as int to setupKernel and as size_t to
+ * setupKernel64; reading an int vararg as size_t would pick up garbage.
+ */
+static size_t readCount( bool wide, va_list *ap)
+{
+   int n;
+
+   if (wide)
+     return va_arg( *ap, size_t);
+   n = va_arg( *ap, int);
+   if (n < 0)
+     die ("Error: negative array length %d passed to setupKernel!", n);
+   return (size_t)n;
+}
+
+static cl_kernel setupKernelV( const char *kernel_source, char *kernel_name,
+                               bool wide, int num_args, va_list *ap)
+{
+   cl_kernel kernel = NULL;
+   int i;
+
+   kernel = createKernel( kernel_source, kernel_name);
+   num_kernel_args = num_args;
+   /* protect the arguments of this kernel from spilling each other */
+   mem_tick++;
+   for(i=0; (i<num_args) && (kernel != NULL); i++) {
+      kernel_args[i].arg_t =va_arg(*ap, clarg_type);
+      switch( kernel_args[i].arg_t) {
+        SETUPARG( Double, double)
+        SETUPARG( Float, float)
+        SETUPARG( Int, int)
+        SETUPARG( Bool, bool)
+        SETUPARG( Half, cl_half)
+        SETUPARG( Char, cl_char)
+        SETUPARG( UChar, cl_uchar)
+        SETUPARG( Short, cl_short)
+        SETUPARG( UShort, cl_ushort)
+        SETUPARG( Long, cl_long)
+        SETUPARG( ULong, cl_ulong)
+        case IntConst:
+          kernel_args[i].val = va_arg(*ap, unsigned int);
+          setKernelArg (kernel, i, sizeof (unsigned int), &kernel_args[i].val);
+          break;
+        case FloatConst:
+          /* Promoted because va_arg pushes to stack */
+          kernel_args[i].valf = va_arg(*ap, double);
+          setKernelArg (kernel, i, sizeof (float), &kernel_args[i].valf);
+          break;
+        case DoubleConst:
+          kernel_args[i].vald = va_arg(*ap, double);
+          setKernelArg (kernel, i, sizeof (double), &kernel_args[i].vald);
+          break;
+        case SVMPtr:
+          kernel_args[i].svm_ptr = va_arg(*ap, void *);
+          if (findSVMEntry( kernel_args[i].svm_ptr) == -1)
+            die ("Error: SVMPtr argument not obtained from allocSVM!");
+          if (capture_file != NULL)
+            fprintf( stderr, "Warning: SVM arguments cannot be captured!\n");
+#ifdef CL_VERSION_2_0
+          CL_SAFE(clSetKernelArgSVMPointer (kernel, i, kernel_args[i].svm_ptr));
+#endif
+          if (num_conc_queues > 0)
+            bindMem( kernel, i, SVM_ARG);
+          break;
+        default:
+          die ("Error: illegal argument tag for executeKernel!");
+      }
+   }
+
+   return kernel;
+}
+
+cl_kernel setupKernel( const char *kernel_source, char *kernel_name, int num_args, ...)
+{
+   cl_kernel kernel;
+   va_list ap;
+
+   va_start(ap, num_args);
+   kernel = setupKernelV( kernel_source, kernel_name, false, num_args, &ap);
+   va_end(ap);
+
+   return kernel;
+}
+
+cl_kernel setupKernel64( const char *kernel_source, char *kernel_name, int num_args, ...)
+{
+   cl_kernel kernel;
+   va_list ap;
+
+   va_start(ap, num_args);
+   kernel = setupKernelV( kernel_source, kernel_name, true, num_args, &ap);
+   va_end(ap);
+
+   return kernel;
+}
+
+static void printRange( FILE *f, const char *what, int dim, size_t *offset,
+                        size_t *global, size_t *local)
+{
+  fprintf( f, "%s a kernel with global [ ", what);
+  for(int i=0; i<dim; i++) {
+    fprintf( f, "%zu ", global[i]);
+  }
+  fprintf( f, "] and local [ ");
+  for(int i=0; (local != NULL) && (i<dim); i++) {
+    fprintf( f, "%zu ", local[i]);
+  }
+  if (offset != NULL) {
+    fprintf( f, "] and offset [ ");
+    for(int i=0; i<dim; i++) {
+      fprintf( f, "%zu ", offset[i]);
+    }
+  }
+  fprintf( f, "]\n");
+}
+
+cl_int launchKernel( cl_kernel kernel, int dim, size_t *global, size_t *local)
+{
+  return launchKernelOffset( kernel, dim, NULL, global, local);
+}
+
+cl_int launchKernelOffset( cl_kernel kernel, int dim, size_t *offset,
+                           size_t *global, size_t *local)
+{
+  cl_int err;
+  cl_event *event = NULL;
+
+  API_ENTER();
+  if (verbose)
+    printRange( stdout, "Trying to launch", dim, offset, global, local);
+  if (capture_file != NULL)
+    captureLaunch( kernel, dim, offset, global, local);
+  restoreKernelMem( kernel);
+  bool svm_unmapped = unmapAllSVM();
+  if (!batch_mode)
+    TIMER_START();
+
+  /*
+   * Launches whose global size exceeds what a single enqueue can address are
+   * split into chunks along all axes; the chunks are placed via the global
+   * offset so that get_global_id yields the same ids as an unsplit launch.
+   */
+  size_t chunk[3], pos[3] = { 0, 0, 0}, cnt[3], off[3];
+  bool split = false;
+  int d;
+
+  /*
+   * In concurrent mode, launches are distributed over the concurrent queues
+   * and wait for the commands producing or consuming their buffer arguments.
+   */
+  cl_command_queue queue = commands;
+  cl_event *deps = NULL;
+  int num_deps = 0, max_deps = 0;
+  int first_event = num_batch_events;
+
+  cl_event svm_done = NULL;
+  bool uses_svm = false;
+
+  if (num_conc_queues > 0) {
+    queue = conc_queues[next_conc_queue++ % num_conc_queues];
+    if (svm_unmapped) {
+      /* the unmaps are enqueued on "commands" rather than on <queue> */
+      CL_SAFE(clEnqueueMarkerWithWaitList( commands, 0, NULL, &svm_done));
+      CL_SAFE(clFlush( commands));
+      appendEvent( &deps, &num_deps, &max_deps, svm_done);
+    }
+    for( int b=0; b< num_bindings; b++) {
+      if ((bindings[b].kernel == kernel) && (bindings[b].mem_id == SVM_ARG))
+        uses_svm = true;
+      else if (bindings[b].kernel == kernel)
+        depWaitList( bindings[b].mem_id, (bindings[b].access & AccessWrite) != 0,
+                     &deps, &num_deps, &max_deps);
+    }
+    if (uses_svm && (svm_last != NULL))
+      appendEvent( &deps, &num_deps, &max_deps, svm_last);
+  }
+
+  for( d=0; d<dim; d++) {
+    size_t base = (offset == NULL ? 0 : offset[d]);
+    if ((base > max_dev_size) || (max_dev_size - base < global[d]))
+      die ("Error: global range [%zu, %zu) in dimension %d exceeds the"
+           " addressable range of the device", base, base + global[d], d);
+    chunk[d] = (max_launch_size < max_dev_size ? max_launch_size : max_dev_size);
+    if ((local != NULL) && (local[d] > 0))
+      chunk[d] = (chunk[d] < local[d] ? local[d] : chunk[d] - chunk[d] % local[d]);
+    split = split || (global[d] > chunk[d]);
+  }
+  if (split && verbose) {
+    printf( "splitting the launch into chunks of at most [%zu", chunk[0]);
+    for( d=1; d<dim; d++)
+      printf( ", %zu", chunk[d]);
+    printf( "] work items\n");
+  }
+
+  do {
+    for( d=0; d<dim; d++) {
+      cnt[d] = (global[d] - pos[d] < chunk[d] ? global[d] - pos[d] : chunk[d]);
+      off[d] = (offset == NULL ? 0 : offset[d]) + pos[d];
+    }
+    if (batch_mode) {
+      if (num_batch_events == max_batch_events) {
+        max_batch_events = (max_batch_events == 0 ? 64 : 2*max_batch_events);
+        batch_events = (cl_event *)realloc( batch_events,
+                                            sizeof( cl_event)*max_batch_events);
+        if (batch_events == NULL)
+          die ("Error: failed to allocate memory for %d batch events", max_batch_events);
+      }
+      event = &batch_events[num_batch_events];
+    }
+    CL_BEGIN();
+    err = clEnqueueNDRangeKernel (queue, kernel, dim, (split ? off : offset),
+                                  cnt, local, num_deps, deps, event);
+    CL_END();
+    if (err != CL_SUCCESS) {
+      printRange( stderr, "Tried launching", dim,
+                  ((split || (offset != NULL)) ? off : NULL), cnt, local);
+      die ("Error: %s", errToStr(err));
+    }
+    if (batch_mode)
+      num_batch_events++;
+
+    /* advance to the next chunk */
+    for( d=0; d<dim; d++) {
+      pos[d] += cnt[d];
+      if (pos[d] < global[d])
+        break;
+      pos[d] = 0;
+    }
+  } while (d < dim);
+
+  if (num_conc_queues > 0) {
+    cl_event done = batch_events[first_event];
+
+    if (num_batch_events - first_event > 1)
+      CL_SAFE(clEnqueueMarkerWithWaitList( queue, num_batch_events - first_event,
+                                           &batch_events[first_event], &done));
+    /* events of unflushed queues must not be waited for on other queues */
+    CL_SAFE(clFlush( queue));
+    for( int b=0; b< num_bindings; b++) {
+      if ((bindings[b].kernel == kernel) && (bindings[b].mem_id != SVM_ARG))
+        depRecord( bindings[b].mem_id, (bindings[b].access & AccessWrite) != 0, done);
+    }
+    if (uses_svm) {
+      CL_SAFE(clRetainEvent( done));
+      if (svm_last != NULL)
+        CL_SAFE(clReleaseEvent( svm_last));
+      svm_last = done;
+    }
+    if (num_batch_events - first_event > 1)
+      CL_SAFE(clReleaseEvent( done));
+  }
+  free( deps);
+  if (svm_done != NULL)
+    CL_SAFE(clReleaseEvent( svm_done));
+
+  if (batch_mode) {
+    num_batch_launches++;
+    if ((batch_sync_every > 0) && (num_batch_launches >= batch_sync_every))
+      syncBatch();
+  } else {
+    /* Wait for all commands to complete.  */
+    CL_SAFE(clFinish (commands));
+    TIMER_STOP();
+    num_kernel++;
+    kernel_time += (stop.tv_sec -start.tv_sec)*1000.0
+                    + (stop.tv_nsec -start.tv_nsec)/1000000.0;
+  }
+  API_LEAVE();
+
+  return CL_SUCCESS;
+}
+
+void setMaxLaunchSize( size_t n)
+{
+  if (n == 0)
+    die ("Error: setMaxLaunchSize requires a positive size!");
+  max_launch_size = n;
+  max_launch_size_set = true;
+}
+
+void startBatch( int sync_every)
+{
+  if (verbose)
+    printf( "starting batch mode, synchronising every %d launches\n", sync_every);
+  if (capture_file != NULL) {
+    capU32( RecBatch);
+    capU32( sync_every);
+  }
+  batch_mode = true;
+  batch_sync_every = sync_every;
+}
+
+cl_int syncBatch()
+{
+  API_ENTER();
+  if (batch_mode && (capture_file != NULL))
+    capU32( RecSync);
+  for( int i=0; i< num_conc_queues; i++)
+    CL_SAFE(clFinish (conc_queues[i]));
+  CL_SAFE(clFinish (commands));
+  for( int id=0; (num_conc_queues > 0) && (id< num_mem_entries); id++) {
+    if (mem_table[id].in_use)
+      depClear( id);
+  }
+  for( int i=0; i< num_batch_events; i++) {
+#ifndef SIMPLE_NO_INSTR
+    cl_ulong ev_start, ev_end;
+
+    CL_SAFE(clGetEventProfilingInfo( batch_events[i], CL_PROFILING_COMMAND_START,
+                                     sizeof(cl_ulong), &ev_start, NULL));
+    CL_SAFE(clGetEventProfilingInfo( batch_events[i], CL_PROFILING_COMMAND_END,
+                                     sizeof(cl_ulong), &ev_end, NULL));
+    kernel_time += (ev_end - ev_start)/1000000.0;
+#endif
+    CL_SAFE(clReleaseEvent( batch_events[i]));
+  }
+  num_kernel += num_batch_launches;
+  if (verbose && (num_batch_launches > 0))
+    printf( "synchronised batch of %d launches\n", num_batch_launches);
+  num_batch_events = 0;
+  num_batch_launches = 0;
+  API_LEAVE();
+
+  return CL_SUCCESS;
+}
+
+void startConcurrent( int num_queues, bool out_of_order)
+{
+  cl_command_queue_properties props = 0;
+
+  if (num_conc_queues > 0)
+    die ("Error: startConcurrent called while already in concurrent mode!");
+  CL_SAFE(clGetDeviceInfo( device_id, CL_DEVICE_QUEUE_PROPERTIES,
+                           sizeof (props), &props, NULL));
+  if (out_of_order && (props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)) {
+    num_conc_queues = 1;
+    props = CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+  } else {
+    num_conc_queues = (num_queues < 1 ? 1 : num_queues);
+    props = 0;
+  }
+  if (verbose)
+    printf( "starting concurrent mode with %d %s queue(s)\n", num_conc_queues,
+            (props ? "out-of-order" : "in-order"));
+  conc_queues = (cl_command_queue *)malloc( sizeof( cl_command_queue)*num_conc_queues);
+  if (conc_queues == NULL)
+    die ("Error: failed to allocate memory for %d queues", num_conc_queues);
+  for( int i=0; i< num_conc_queues; i++)
+    conc_queues[i] = createQueue( props);
+  next_conc_queue = 0;
+  startBatch( 0);
+}
+
+cl_int stopConcurrent()
+{
+  syncBatch();
+  for( int i=0; i< num_conc_queues; i++)
+    CL_SAFE(clReleaseCommandQueue (conc_queues[i]));
+  free( conc_queues);
+  conc_queues = NULL;
+  num_conc_queues = 0;
+  if (svm_last != NULL)
+    CL_SAFE(clReleaseEvent( svm_last));
+  svm_last = NULL;
+  free( bindings);
+  bindings = NULL;
+  num_bindings = 0;
+
+  return stopBatch();
+}
+
+cl_int stopBatch()
+{
+  cl_int err = syncBatch();
+
+  if (batch_mode && (capture_file != NULL))
+    capU32( RecUnbatch);
+  /* concurrent mode relies on batched launches */
+  batch_mode = (num_conc_queues > 0);
+  return err;
+}
+
+#define FETCH( tname, t)                                     \
+case tname ## Arr:                                           \
+   dev2host ## tname ## Arr (                                \
+                   mem_table[kernel_args[i].mem_id].buf,     \
+                   kernel_args[i].t ## _host_buf,            \
+                   kernel_args[i].num_elems);                \
+break;
+
+cl_int runKernel( cl_kernel kernel, int dim, size_t *global, size_t *local)
+{
+  cl_int err = CL_SUCCESS;
+
+  API_ENTER();
+  launchKernel( kernel, dim, global, local);
+
+  for( int i=0; i< num_kernel_args; i++) {
+      switch( kernel_args[i].arg_t) {
+          FETCH( Double, double)
+          FETCH( Float, float)
+          FETCH( Int, int)
+          FETCH( Bool, bool)
+          FETCH( Half, cl_half)
+          FETCH( Char, cl_char)
+          FETCH( UChar, cl_uchar)
+          FETCH( Short, cl_short)
+          FETCH( UShort, cl_ushort)
+          FETCH( Long, cl_long)
+          FETCH( ULong, cl_ulong)
+          case SVMPtr:
+              /* the data is shared; just make it accessible again */
+              mapSVM();
+              break;
+          case IntConst:
+              /* do nothing */
+              break;
+          case FloatConst:
+              /* do nothing */
+              break;
+          case DoubleConst:
+              /* do nothing */
+              break;
+          default:
+              die ("Error: illegal argument tag in runKernel!");
+              kernel = NULL;
+      }
+  }
+  API_LEAVE();
+
+  return err;
+}
+
+static ew_expr *newExpr( ew_op op)
+{
+  ew_expr *e = (ew_expr *)malloc( sizeof( ew_expr));
+  if (e == NULL)
+    die ("Error: failed to allocate memory for an expression node");
+  e->op = op;
+  e->arg = 0;
+  e->val = 0.0;
+  e->left = NULL;
+  e->right = NULL;
+  return e;
+}
+
+ew_expr *ewArg( int i)
+{
+  ew_expr *e = newExpr( EwArg);
+  e->arg = i;
+  return e;
+}
+
+ew_expr *ewConst( double val)
+{
+  ew_expr *e = newExpr( EwConst);
+  e->val = val;
+  return e;
+}
+
+ew_expr *ewUnary( ew_op op, ew_expr *a)
+{
+  if ((op < EwNeg) || (op > EwAbs))
+    die ("Error: ewUnary called with a non-unary operator!");
+  ew_expr *e = newExpr( op);
+  e->left = a;
+  return e;
+}
+
+ew_expr *ewBinary( ew_op op, ew_expr *a, ew_expr *b)
+{
+  if ((op < EwAdd) || (op > EwMax))
+    die ("Error: ewBinary called with a non-binary operator!");
+  ew_expr *e = newExpr( op);
+  e->left = a;
+  e->right = b;
+  return e;
+}
+
+void ewFree( ew_expr *e)
+{
+  if (e != NULL) {
+    ewFree( e->left);
+    ewFree( e->right);
+    free( e);
+  }
+}
+
+/* growable string used for generating kernel sources */
+typedef struct {
+  char  *str;
+  size_t len;
+  size_t size;
+} strbuf;
+
+static void sbPrintf( strbuf *sb, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start( ap, fmt);
+  n = vsnprintf( NULL, 0, fmt, ap);
+  va_end( ap);
+  while (sb->len + n + 1 > sb->size) {
+    sb->size = (sb->size == 0 ? 1024 : 2*sb->size);
+    sb->str = (char *)realloc( sb->str, sb->size);
+    if (sb->str == NULL)
+      die ("Error: failed to allocate memory for kernel source");
+  }
+  va_start( ap, fmt);
+  vsnprintf( sb->str + sb->len, n + 1, fmt, ap);
+  va_end( ap);
+  sb->len += n;
+}
+
+static const char *ewTypeName( clarg_type type)
+{
+  switch( type) {
+    case DoubleArr: return "double";
+    case FloatArr:  return "float";
+    case IntArr:    return "int";
+    default:
+      die ("Error: element-wise expressions support DoubleArr, FloatArr and IntArr only!");
+  }
+  return NULL;
+}
+
+static int ewMaxArg( ew_expr *e)
+{
+  int l, r;
+
+  if (e == NULL)
+    return -1;
+  if (e->op == EwArg)
+    return e->arg;
+  l = ewMaxArg( e->left);
+  r = ewMaxArg( e->right);
+  return (l > r ? l : r);
+}
+
+/*
+ * Emits one temporary per node of <e>, children first, and returns the number
+ * of the temporary holding the value of <e>. This keeps the source linear in
+ * the size of the expression even if a node is referenced twice (EwSqr).
+ */
+static int ewGen( strbuf *sb, ew_expr *e, clarg_type type, int *num_tmps)
+{
+  const char *t = ewTypeName( type);
+  int l = -1, r = -1, k;
+
+  if ((e->op != EwArg) && (e->op != EwConst) && (e->left != NULL))
+    l = ewGen( sb, e->left, type, num_tmps);
+  if ((e->op != EwArg) && (e->op != EwConst) && (e->right != NULL))
+    r = ewGen( sb, e->right, type, num_tmps);
+  k = (*num_tmps)++;
+  sbPrintf( sb, "      %s t%d = ", t, k);
+
+  switch( e->op) {
+    case EwArg:
+      sbPrintf( sb, "a%d", e->arg);
+      break;
+    case EwConst:
+      /* %g would print inf or nan, which OpenCL C does not know */
+      if (!isfinite( e->val) && (type == IntArr))
+        die ("Error: non-finite constants are not supported on IntArr expressions!");
+      if (isnan( e->val))
+        sbPrintf( sb, "((%s)NAN)", t);
+      else if (isinf( e->val))
+        sbPrintf( sb, "(%s(%s)INFINITY)", (e->val < 0 ? "-" : ""), t);
+      else
+        sbPrintf( sb, "((%s)(%.17g))", t, e->val);
+      break;
+    case EwNeg:
+      sbPrintf( sb, "-t%d", l);
+      break;
+    case EwSqr:
+      sbPrintf( sb, "t%d*t%d", l, l);
+      break;
+    case EwSqrt:
+    case EwExp:
+      if (type == IntArr)
+        die ("Error: sqrt and exp are not supported on IntArr expressions!");
+      sbPrintf( sb, "%s(t%d)", (e->op == EwSqrt ? "sqrt" : "exp"), l);
+      break;
+    case EwAbs:
+      sbPrintf( sb, "%s(t%d)", (type == IntArr ? "abs" : "fabs"), l);
+      break;
+    case EwAdd:
+    case EwSub:
+    case EwMul:
+    case EwDiv:
+      sbPrintf( sb, "t%d %s t%d", l,
+                (e->op == EwAdd ? "+" : e->op == EwSub ? "-" : e->op == EwMul ? "*" : "/"),
+                r);
+      break;
+    case EwMin:
+    case EwMax:
+      if (type == IntArr)
+        sbPrintf( sb, "%s(t%d,t%d)", (e->op == EwMin ? "min" : "max"), l, r);
+      else
+        sbPrintf( sb, "%s(t%d,t%d)", (e->op == EwMin ? "fmin" : "fmax"), l, r);
+      break;
+    default:
+      die ("Error: illegal operator in element-wise expression!");
+  }
+  sbPrintf( sb, ";\n");
+  return k;
+}
+
+cl_kernel ewKernel( clarg_type type, ew_expr *e, int num_inputs)
+{
+  strbuf sb = { NULL, 0, 0};
+  const char *t = ewTypeName( type);
+  int num_tmps = 0;
+  int res;
+
+  if (ewMaxArg( e) >= num_inputs)
+    die ("Error: element-wise expression refers to input %d but only %d inputs are given!",
+         ewMaxArg( e), num_inputs);
+
+  if (type == DoubleArr)
+    sbPrintf( &sb, "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n");
+  sbPrintf( &sb, "__kernel void ew_fused( __global %s *out", t);
+  for( int i=0; i< num_inputs; i++)
+    sbPrintf( &sb, ", __global const %s *in%d", t, i);
+  sbPrintf( &sb, ", const ulong count)\n{\n   size_t i = get_global_id(0);\n");
+  sbPrintf( &sb, "   if (i < count) {\n");
+  for( int i=0; i< num_inputs; i++)
+    sbPrintf( &sb, "      %s a%d = in%d[i];\n", t, i, i);
+  res = ewGen( &sb, e, type, &num_tmps);
+  sbPrintf( &sb, "      out[i] = t%d;\n   }\n}\n", res);
+
+  for( int i=0; i< num_ew_cache; i++) {
+    if (strcmp( ew_cache[i].source, sb.str) == 0) {
+      free( sb.str);
+      return ew_cache[i].kernel;
+    }
+  }
+  if (verbose)
+    printf( "building fused element-wise kernel:\n%s", sb.str);
+  ew_cache = (ew_cache_entry *)realloc( ew_cache,
+                                        sizeof( ew_cache_entry)*(num_ew_cache+1));
+  if (ew_cache == NULL)
+    die ("Error: failed to allocate memory for the kernel cache");
+  ew_cache[num_ew_cache].source = sb.str;
+  ew_cache[num_ew_cache].kernel = buildKernel( sb.str, "ew_fused", NULL,
+                                               &ew_cache[num_ew_cache].program);
+  if (capture_file != NULL)
+    captureKernel( ew_cache[num_ew_cache].kernel, sb.str, "ew_fused", NULL);
+  return ew_cache[num_ew_cache++].kernel;
+}
+
+static void ewHost2Dev( clarg_type type, void *a, cl_mem ad, size_t n)
+{
+  switch( type) {
+    case DoubleArr: host2devDoubleArr( (double *)a, ad, n); break;
+    case FloatArr:  host2devFloatArr( (float *)a, ad, n); break;
+    case IntArr:    host2devIntArr( (int *)a, ad, n); break;
+    default:        ewTypeName( type);
+  }
+}
+
+static void ewDev2Host( clarg_type type, cl_mem ad, void *a, size_t n)
+{
+  switch( type) {
+    case DoubleArr: dev2hostDoubleArr( ad, (double *)a, n); break;
+    case FloatArr:  dev2hostFloatArr( ad, (float *)a, n); break;
+    case IntArr:    dev2hostIntArr( ad, (int *)a, n); break;
+    default:        ewTypeName( type);
+  }
+}
+
+static size_t ewElemSize( clarg_type type)
+{
+  switch( type) {
+    case DoubleArr: return sizeof (double);
+    case FloatArr:  return sizeof (float);
+    case IntArr:    return sizeof (int);
+    default:        ewTypeName( type);
+  }
+  return 0;
+}
+
+void runElementwise( clarg_type type, ew_expr *e, size_t n, void *out,
+                     int num_inputs, ...)
+{
+  va_list ap;
+  cl_kernel kernel;
+  size_t bytes = ewElemSize( type) * n;
+  cl_mem *bufs;
+  cl_ulong count = n;
+  size_t global[1] = { n };
+
+  if (n == 0)
+    return;
+  kernel = ewKernel( type, e, num_inputs);
+  bufs = (cl_mem *)malloc( sizeof( cl_mem) * (num_inputs + 1));
+  if (bufs == NULL)
+    die ("Error: failed to allocate memory for %d buffers", num_inputs + 1);
+
+  bufs[0] = allocDev( bytes);
+  setKernelArg (kernel, 0, sizeof (cl_mem), &bufs[0]);
+  va_start( ap, num_inputs);
+  for( int i=1; i<= num_inputs; i++) {
+    bufs[i] = allocDev( bytes);
+    ewHost2Dev( type, va_arg( ap, void *), bufs[i], n);
+    setKernelArg (kernel, i, sizeof (cl_mem), &bufs[i]);
+  }
+  va_end( ap);
+  setKernelArg (kernel, num_inputs + 1, sizeof (cl_ulong), &count);
+
+  launchKernel( kernel, 1, global, NULL);
+  ewDev2Host( type, bufs[0], out, n);
+
+  for( int i=0; i<= num_inputs; i++)
+    freeDev( bufs[i]);
+  free( bufs);
+}
+
+static void repBytes( FILE *f, void *p, size_t n)
+{
+  if (fread( p, 1, n, f) != n)
+    die ("Error: capture file is truncated");
+}
+
+static uint32_t repU32( FILE *f)
+{
+  uint32_t v;
+  repBytes( f, &v, sizeof (v));
+  return v;
+}
+
+static uint64_t repU64( FILE *f)
+{
+  uint64_t v;
+  repBytes( f, &v, sizeof (v));
+  return v;
+}
+
+static char *repStr( FILE *f)
+{
+  size_t n = repU64( f);
+  char *str = (char *)malloc( n + 1);
+  if (str == NULL)
+    die ("Error: failed to allocate memory for a string of size %zu", n + 1);
+  repBytes( f, str, n);
+  str[n] = 0;
+  return str;
+}
+
+/*
+ * A parsed capture file: the kernels are built once when loading, all other
+ * records are kept in memory so that they can be executed repeatedly.
+ */
+typedef struct {
+  uint32_t tag;
+  uint32_t kernel;          /* RecArgBuf, RecArgVal, RecLaunch */
+  uint32_t idx;             /* RecArgBuf, RecArgVal; sync_every for RecBatch */
+  uint32_t buf;             /* RecAlloc, RecFree, RecH2D, RecD2H, RecArgBuf */
+  size_t   offset;          /* RecH2D, RecD2H */
+  size_t   size;            /* RecAlloc, RecH2D, RecD2H, RecArgVal */
+  void    *data;            /* RecH2D, RecArgVal (may be NULL) */
+  int      dim;             /* RecLaunch */
+  bool     has_offset;
+  bool     has_local;
+  size_t   range[3][3];     /* RecLaunch: offset, global and local */
+} replay_rec;
+
+struct replay_session {
+  cl_kernel  *kernels;
+  cl_program *programs;
+  int         num_kernels;
+  int         num_bufs;
+  replay_rec *recs;
+  int         num_recs;
+  int         max_recs;
+};
+
+static replay_rec *newRec( replay_session *s, uint32_t tag)
+{
+  if (s->num_recs == s->max_recs) {
+    s->max_recs = (s->max_recs == 0 ? 64 : 2*s->max_recs);
+    s->recs = (replay_rec *)realloc( s->recs, sizeof( replay_rec)*s->max_recs);
+    if (s->recs == NULL)
+      die ("Error: failed to allocate memory for %d replay records", s->max_recs);
+  }
+  memset( &s->recs[s->num_recs], 0, sizeof( replay_rec));
+  s->recs[s->num_recs].tag = tag;
+  return &s->recs[s->num_recs++];
+}
+
+static void checkRecKernel( replay_session *s, uint32_t id)
+{
+  if ((id >= (uint32_t)s->num_kernels) || (s->kernels[id] == NULL))
+    die ("Error: capture file refers to unknown kernel %u", id);
+}
+
+static void checkRecBuf( replay_session *s, uint32_t id)
+{
+  if (id >= (uint32_t)s->num_bufs)
+    die ("Error: capture file refers to unknown buffer %u", id);
+}
+
+replay_session *loadSession( const char *fname)
+{
+  FILE *f;
+  char magic[sizeof (CAPTURE_MAGIC)];
+  replay_session *s;
+  replay_rec *r;
+  uint32_t tag;
+
+  f = fopen( fname, "rb");
+  if (f == NULL)
+    die ("Error: capture file \"%s\" not found!", fname);
+  repBytes( f, magic, strlen( CAPTURE_MAGIC));
+  if (strncmp( magic, CAPTURE_MAGIC, strlen( CAPTURE_MAGIC)) != 0)
+    die ("Error: \"%s\" is not a capture file!", fname);
+  s = (replay_session *)calloc( 1, sizeof( replay_session));
+  if (s == NULL)
+    die ("Error: failed to allocate memory for a replay session");
+
+  while (fread( &tag, sizeof (tag), 1, f) == 1) {
+    switch( tag) {
+      case RecKernel: {
+        uint32_t id = repU32( f);
+        char *source = repStr( f);
+        char *name = repStr( f);
+        char *options = repStr( f);
+        if (id >= (uint32_t)s->num_kernels) {
+          s->kernels = (cl_kernel *)realloc( s->kernels, sizeof( cl_kernel)*(id+1));
+          s->programs = (cl_program *)realloc( s->programs, sizeof( cl_program)*(id+1));
+          if ((s->kernels == NULL) || (s->programs == NULL))
+            die ("Error: failed to allocate memory for %u kernels", id+1);
+          for( uint32_t i=s->num_kernels; i<= id; i++) {
+            s->kernels[i] = NULL;
+            s->programs[i] = NULL;
+          }
+          s->num_kernels = id+1;
+        }
+        s->kernels[id] = buildKernel( source, name, (options[0] == 0 ? NULL : options),
+                                      &s->programs[id]);
+        free( source);
+        free( name);
+        free( options);
+        break;
+      }
+      case RecAlloc:
+        r = newRec( s, tag);
+        r->buf = repU32( f);
+        r->size = repU64( f);
+        if (r->buf >= (uint32_t)s->num_bufs)
+          s->num_bufs = r->buf+1;
+        break;
+      case RecFree:
+        r = newRec( s, tag);
+        r->buf = repU32( f);
+        checkRecBuf( s, r->buf);
+        break;
+      case RecH2D:
+      case RecD2H:
+        r = newRec( s, tag);
+        r->buf = repU32( f);
+        r->offset = repU64( f);
+        r->size = repU64( f);
+        checkRecBuf( s, r->buf);
+        if (tag == RecH2D) {
+          r->data = malloc( r->size);
+          if ((r->data == NULL) && (r->size > 0))
+            die ("Error: failed to allocate %s of host memory", getMemStr( r->size));
+          repBytes( f, r->data, r->size);
+        }
+        break;
+      case RecArgBuf:
+        r = newRec( s, tag);
+        r->kernel = repU32( f);
+        r->idx = repU32( f);
+        r->buf = repU32( f);
+        checkRecKernel( s, r->kernel);
+        checkRecBuf( s, r->buf);
+        break;
+      case RecArgVal:
+        r = newRec( s, tag);
+        r->kernel = repU32( f);
+        r->idx = repU32( f);
+        r->size = repU64( f);
+        checkRecKernel( s, r->kernel);
+        if (repU32( f)) {
+          r->data = malloc( r->size);
+          if (r->data == NULL)
+            die ("Error: failed to allocate memory for a kernel argument");
+          repBytes( f, r->data, r->size);
+        }
+        break;
+      case RecLaunch:
+        r = newRec( s, tag);
+        r->kernel = repU32( f);
+        r->dim = repU32( f);
+        checkRecKernel( s, r->kernel);
+        if ((r->dim < 1) || (r->dim > 3))
+          die ("Error: illegal dimensionality %d in capture file", r->dim);
+        r->has_offset = repU32( f);
+        for( int i=0; r->has_offset && (i<r->dim); i++)
+          r->range[0][i] = repU64( f);
+        for( int i=0; i<r->dim; i++)
+          r->range[1][i] = repU64( f);
+        r->has_local = repU32( f);
+        for( int i=0; r->has_local && (i<r->dim); i++)
+          r->range[2][i] = repU64( f);
+        break;
+      case RecBatch:
+        r = newRec( s, tag);
+        r->idx = repU32( f);
+        break;
+      case RecSync:
+      case RecUnbatch:
+        newRec( s, tag);
+        break;
+      default:
+        die ("Error: illegal record %u in capture file", tag);
+    }
+  }
+  fclose( f);
+
+  return s;
+}
+
+int runSession( replay_session *s)
+{
+  cl_mem *bufs;
+  char **mirrors;
+  int num_launches = 0;
+
+  bufs = (cl_mem *)calloc( s->num_bufs + 1, sizeof( cl_mem));
+  mirrors = (char **)calloc( s->num_bufs + 1, sizeof( char *));
+  if ((bufs == NULL) || (mirrors == NULL))
+    die ("Error: failed to allocate memory for %d buffers", s->num_bufs);
+
+  for( int i=0; i< s->num_recs; i++) {
+    replay_rec *r = &s->recs[i];
+
+    switch( r->tag) {
+      case RecAlloc:
+        bufs[r->buf] = allocDev( r->size);
+        mirrors[r->buf] = (char *)malloc( r->size);
+        if (mirrors[r->buf] == NULL)
+          die ("Error: failed to allocate %s of host memory", getMemStr( r->size));
+        break;
+      case RecFree:
+        freeDev( bufs[r->buf]);
+        free( mirrors[r->buf]);
+        mirrors[r->buf] = NULL;
+        break;
+      case RecH2D:
+        memcpy( mirrors[r->buf] + r->offset, r->data, r->size);
+        host2devBytes( mirrors[r->buf], bufs[r->buf], r->offset, r->size);
+        break;
+      case RecD2H:
+        dev2hostBytes( bufs[r->buf], mirrors[r->buf], r->offset, r->size);
+        break;
+      case RecArgBuf:
+        setKernelArg( s->kernels[r->kernel], r->idx, sizeof (cl_mem), &bufs[r->buf]);
+        break;
+      case RecArgVal:
+        setKernelArg( s->kernels[r->kernel], r->idx, r->size, r->data);
+        break;
+      case RecLaunch:
+        launchKernelOffset( s->kernels[r->kernel], r->dim,
+                            (r->has_offset ? r->range[0] : NULL), r->range[1],
+                            (r->has_local ? r->range[2] : NULL));
+        num_launches++;
+        break;
+      case RecBatch:
+        startBatch( r->idx);
+        break;
+      case RecSync:
+        syncBatch();
+        break;
+      case RecUnbatch:
+        stopBatch();
+        break;
+    }
+  }
+
+  syncBatch();
+  for( int i=0; i< s->num_bufs; i++) {
+    if (mirrors[i] != NULL) {
+      freeDev( bufs[i]);
+      free( mirrors[i]);
+    }
+  }
+  free( bufs);
+  free( mirrors);
+
+  return num_launches;
+}
+
+void freeSession( replay_session *s)
+{
+  for( int i=0; i< s->num_recs; i++)
+    free( s->recs[i].data);
+  free( s->recs);
+  for( int i=0; i< s->num_kernels; i++) {
+    if (s->kernels[i] != NULL) {
+      releaseKernel( s->kernels[i]);
+      CL_SAFE(clReleaseProgram (s->programs[i]));
+    }
+  }
+  free( s->kernels);
+  free( s->programs);
+  free( s);
+}
+
+int replaySession( const char *fname)
+{
+  replay_session *s = loadSession( fname);
+  int num_launches = runSession( s);
+
+  freeSession( s);
+  return num_launches;
+}
+
+void printKernelTime()
+{
+#ifdef SIMPLE_NO_INSTR
+  printf( "%d kernel executions\n", num_kernel);
+#else
+  printf( "total time spent in %d kernel executions: %s\n", num_kernel, getTimeStr( kernel_time));
+#endif
+}
+
+void printTransferTimes()
+{
+#ifdef SIMPLE_NO_INSTR
+  printf( "%d host to device transfers\n", num_h2d);
+  printf( "%d device to host transfers\n", num_d2h);
+  for( int k=XferPageable; k<=XferStaged; k++) {
+    if (xfer_bytes[k] > 0)
+      printf( "  %-8s: %s\n", xferStr( (xfer_kind)k), getMemStr( xfer_bytes[k]));
+  }
+#else
+  printf( "total time spent in %d host to device transfers : %s\n", num_h2d, getTimeStr( h2d_time));
+  printf( "total time spent in %d device to host transfers : %s\n", num_d2h, getTimeStr( d2h_time));
+  for( int k=XferPageable; k<=XferStaged; k++) {
+    if (xfer_bytes[k] > 0) {
+      printf( "  %-8s: %s", xferStr( (xfer_kind)k), getMemStr( xfer_bytes[k]));
+      printf( " in %s", getTimeStr( xfer_time[k]));
+      if (xfer_time[k] > 0.0)
+        printf( " (%.2f GB/s)", xfer_bytes[k] / 1073741824.0 / (xfer_time[k] / 1000.0));
+      printf( "\n");
+    }
+  }
+#endif
+}
+
+void printOverhead()
+{
+#ifdef SIMPLE_COUNT_OVERHEAD
+  printf( "%lu wrapper calls took %s", ov_calls, getTimeStr( ov_total));
+  printf( ", of which %s in openCL calls\n", getTimeStr( ov_cl));
+  printf( "wrapper overhead: %s", getTimeStr( ov_total - ov_cl));
+  if (ov_calls > 0)
+    printf( " (%.3f usec per call)", (ov_total - ov_cl) * 1000.0 / ov_calls);
+  printf( "\n");
+#else
+  printf( "overhead counting is disabled; rebuild with -DSIMPLE_COUNT_OVERHEAD\n");
+#endif
+}
+
+void resetOverhead()
+{
+#ifdef SIMPLE_COUNT_OVERHEAD
+  ov_calls = 0;
+  ov_total = 0.0;
+  ov_cl = 0.0;
+#endif
+}
+
+void printMemStats()
+{
+  printf( "device memory in use: %s", getMemStr( mem_live));
+  printf( " of a budget of %s\n", getMemStr( mem_budget));
+  printf( "%d buffers spilled to the host (%s)", num_spills, getMemStr( spill_bytes));
+  printf( ", %d buffers restored to the device\n", num_restores);
+}
+
+cl_int freeDevice()
+{
+  stopConcurrent();
+  stopCapture();
+  for( int i=0; i< num_ew_cache; i++) {
+    CL_SAFE(clReleaseKernel (ew_cache[i].kernel));
+    CL_SAFE(clReleaseProgram (ew_cache[i].program));
+    free( ew_cache[i].source);
+  }
+  free( ew_cache);
+  ew_cache = NULL;
+  num_ew_cache = 0;
+  free( batch_events);
+  batch_events = NULL;
+  max_batch_events = 0;
+  for( int id=0; id< num_mem_entries; id++) {
+    if (mem_table[id].in_use && mem_table[id].spillable) {
+      if (mem_table[id].buf != NULL)
+        CL_SAFE(clReleaseMemObject (mem_table[id].buf));
+      free( mem_table[id].host_copy);
+    }
+    if (mem_table[id].in_use)
+      free( mem_table[id].reads);
+  }
+  free( mem_table);
+  free( bindings);
+  bindings = NULL;
+  num_bindings = 0;
+  mem_table = NULL;
+  num_mem_entries = 0;
+  while (num_svm > 0)
+    freeSVM( svm_table[0].ptr);
+  free( svm_table);
+  svm_table = NULL;
+  max_svm = 0;
+  while (num_pinned > 0)
+    freePinned( pinned_table[0].ptr);
+  free( pinned_table);
+  pinned_table = NULL;
+  max_pinned = 0;
+  if (staging_ready) {
+    for( int i=0; i< STAGING_SLOTS; i++)
+      unmapPinned( staging_buf[i], staging_ptr[i]);
+    staging_ready = false;
+  }
+  mem_live = 0;
+  if (program != NULL) {
+    CL_SAFE(clReleaseProgram (program));
+    program = NULL;
   }
-  CL_SAFE(clReleaseProgram (program));
   CL_SAFE(clReleaseCommandQueue (commands));
   CL_SAFE(clReleaseContext (context));
 
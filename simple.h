@@ -4,6 +4,10 @@
 #include <stdbool.h>
 #include <CL/cl.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Macro to help with error checking */
 #define CL_SAFE(fncall)                                                         \
 {                                                                               \
@@ -164,11 +168,36 @@ extern cl_int initCPUVerbose ();
  *                 on whether these are pointers to float-arrays or integer values:
  *
  * legal argument sets are:
- *    doubleArr::clarg_type, num_elems::int, pointer::double *,     and
+ *    DoubleArr::clarg_type, num_elems::int, pointer::double *,     and
  *    FloatArr::clarg_type, num_elems::int, pointer::float *,     and
+ *    IntArr::clarg_type, num_elems::int, pointer::int *,     and
+ *    BoolArr::clarg_type, num_elems::int, pointer::bool *,     and
+ *    HalfArr::clarg_type, num_elems::int, pointer::cl_half *,     and
+ *    CharArr::clarg_type, num_elems::int, pointer::cl_char *,     and
+ *    UCharArr::clarg_type, num_elems::int, pointer::cl_uchar *,     and
+ *    ShortArr::clarg_type, num_elems::int, pointer::cl_short *,     and
+ *    UShortArr::clarg_type, num_elems::int, pointer::cl_ushort *,     and
+ *    LongArr::clarg_type, num_elems::int, pointer::cl_long *,     and
+ *    ULongArr::clarg_type, num_elems::int, pointer::cl_ulong *,     and
  *    IntConst::clarg_type, number::int
  *    FloatConst::clarg_type, number::float
  *    DoubleConst::clarg_type, number::double
+ *    SVMPtr::clarg_type, pointer::void *  (obtained from allocSVM)
+ *
+ *               HalfArr elements are stored on the host as raw 16-bit
+ *               values (cl_half); kernels see them as half arrays. HalfArr
+ *               requires cl_khr_fp16 and LongArr / ULongArr require 64-bit
+ *               integer support (see hasFp16 / hasInt64); setupKernel
+ *               rejects them on devices lacking that support. On such
+ *               devices half data can still be transferred with the typed
+ *               transfer functions below and be read through vload_half.
+ *
+ *               Note that num_elems is read as an int through varargs.
+ *
+ * setupKernel64 : like setupKernel, but all num_elems are read as size_t
+ *                 which allows for arrays of 2^31 elements and more. As the
+ *                 arguments are read through varargs, int variables need a
+ *                 cast such as (size_t)count!
  *
  *               If anything goes wrong in the course, error messages will be
  *               printed to stderr. The pointer to the fully prepared kernel
@@ -188,10 +217,19 @@ typedef enum {
   BoolArr,
   IntConst,
   FloatConst,
-  DoubleConst
+  DoubleConst,
+  SVMPtr,
+  HalfArr,
+  CharArr,
+  UCharArr,
+  ShortArr,
+  UShortArr,
+  LongArr,
+  ULongArr
 } clarg_type;
 
 extern cl_kernel setupKernel( const char *kernel_source, char *kernel_name, int num_args, ...);
+extern cl_kernel setupKernel64( const char *kernel_source, char *kernel_name, int num_args, ...);
 
 
 /*******************************************************************************
@@ -224,6 +262,104 @@ extern cl_int freeDevice();
  ******************************************************************************/
 extern cl_mem allocDev( size_t n);
 
+/*******************************************************************************
+ *
+ * freeDev : releases a device buffer obtained from allocDev and removes it
+ *           from the device memory accounting.
+ *
+ ******************************************************************************/
+extern void freeDev( cl_mem buf);
+
+/*******************************************************************************
+ *
+ * setMemBudget : sets the number of bytes of device memory the wrapper may
+ *                use. It defaults to the global memory size of the device
+ *                selected by each initialisation; an explicit budget is kept
+ *                across freeDevice.
+ *                Whenever an allocation would exceed the budget (or fails),
+ *                the least recently used buffers of kernel arguments set up
+ *                by setupKernel are spilled to host memory. They are restored
+ *                transparently before the next launch of their kernel.
+ *                Buffers obtained from allocDev are accounted for but never
+ *                spilled as their handles are owned by the caller.
+ *
+ * getMemLive : returns the number of bytes currently allocated on the device.
+ *
+ * printMemStats : prints the memory in use, the budget and the number of
+ *                 spills and restores to stdout.
+ *
+ ******************************************************************************/
+extern void setMemBudget( size_t bytes);
+extern size_t getMemLive();
+extern void printMemStats();
+
+/*******************************************************************************
+ *
+ * hasFp16 : returns true iff the device supports half precision arithmetic
+ *           (cl_khr_fp16). This is detected during initialisation.
+ *
+ * hasInt64 : returns true iff the device supports 64-bit integers. This holds
+ *            for all full profile devices; embedded profile devices need the
+ *            cles_khr_int64 extension.
+ *
+ ******************************************************************************/
+extern bool hasFp16();
+extern bool hasInt64();
+
+/*******************************************************************************
+ *
+ * hasSVM : returns true iff the device supports shared virtual memory
+ *          (OpenCL 2.0 or later). This is detected during initialisation.
+ *
+ * hasFineGrainSVM : returns true iff the device supports fine-grained SVM
+ *                   buffers, i.e., host and device can access shared data
+ *                   without any mapping.
+ *
+ * allocSVM : allocates "n" bytes of shared virtual memory. Fine-grained SVM
+ *            is used whenever the device supports it, coarse-grained SVM
+ *            otherwise. The memory can be used directly by the host and
+ *            be passed to kernels as SVMPtr arguments of setupKernel or via
+ *            clSetKernelArgSVMPointer without any copies.
+ *
+ * freeSVM : releases memory obtained from allocSVM.
+ *
+ * mapSVM / unmapSVM : coarse-grained SVM may only be accessed by the host
+ *            while it is mapped. allocSVM returns mapped memory; launchKernel
+ *            unmaps all SVM before launching and runKernel maps it again
+ *            afterwards. After launchKernel, call mapSVM before touching SVM
+ *            data on the host. For fine-grained SVM both are no-ops.
+ *
+ ******************************************************************************/
+extern bool hasSVM();
+extern bool hasFineGrainSVM();
+extern void *allocSVM( size_t n);
+extern void freeSVM( void *p);
+extern void mapSVM();
+extern void unmapSVM();
+
+/*******************************************************************************
+ *
+ * allocPinned : allocates "n" bytes of pinned (page-locked) host memory. It is
+ *               backed by a CL_MEM_ALLOC_HOST_PTR buffer that stays mapped
+ *               until freePinned is called. Transfers from or to pinned memory
+ *               run at full DMA bandwidth without any intermediate copies.
+ *
+ * freePinned : releases memory obtained from allocPinned.
+ *
+ * setStagingThreshold : transfers of at least "bytes" bytes from or to
+ *                       ordinary (pageable) host memory are chunked through
+ *                       a small ring of pinned staging buffers. The default
+ *                       is 1 MB for GPUs; on CPU devices staging is disabled.
+ *                       SIZE_MAX disables staging. An explicit threshold is
+ *                       kept across freeDevice. printTransferTimes reports
+ *                       the bandwidth achieved for pageable, pinned and
+ *                       staged transfers separately.
+ *
+ ******************************************************************************/
+extern void *allocPinned( size_t n);
+extern void freePinned( void *p);
+extern void setStagingThreshold( size_t bytes);
+
 /*******************************************************************************
  *
  * host2dev<type>Arr : transfers "n" elements of type <type> of the array "a"
@@ -234,6 +370,66 @@ extern void host2devDoubleArr( double *a, cl_mem ad, size_t n);
 extern void host2devFloatArr( float *a, cl_mem ad, size_t n);
 extern void host2devIntArr( int *a, cl_mem ad, size_t n);
 extern void host2devBoolArr( bool *a, cl_mem ad, size_t n);
+extern void host2devHalfArr( cl_half *a, cl_mem ad, size_t n);
+extern void host2devCharArr( cl_char *a, cl_mem ad, size_t n);
+extern void host2devUCharArr( cl_uchar *a, cl_mem ad, size_t n);
+extern void host2devShortArr( cl_short *a, cl_mem ad, size_t n);
+extern void host2devUShortArr( cl_ushort *a, cl_mem ad, size_t n);
+extern void host2devLongArr( cl_long *a, cl_mem ad, size_t n);
+extern void host2devULongArr( cl_ulong *a, cl_mem ad, size_t n);
+
+/*******************************************************************************
+ *
+ * host2dev<type>ArrRange : transfers the "n" elements starting at element
+ *                          "offset" of the array "a" on the host to the same
+ *                          elements of the device buffer at "ad". This allows
+ *                          to update a window of a device resident array only.
+ *
+ * host2dev<type>ArrRect : transfers a 2-D or 3-D box of the array "a" on the
+ *                         host to the same box of the device buffer at "ad".
+ *                         Both arrays are seen as row-major arrays with
+ *                         "row_len" elements per row and "num_rows" rows per
+ *                         slice. "origin" and "region" are vectors of length 3
+ *                         that give the start and the extent of the box in
+ *                         elements, rows and slices. For 2-D boxes, region[2]
+ *                         needs to be 1. An empty box, i.e., a 0 in region,
+ *                         transfers nothing.
+ *
+ ******************************************************************************/
+extern void host2devDoubleArrRange( double *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devFloatArrRange( float *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devIntArrRange( int *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devBoolArrRange( bool *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devHalfArrRange( cl_half *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devCharArrRange( cl_char *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devUCharArrRange( cl_uchar *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devShortArrRange( cl_short *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devUShortArrRange( cl_ushort *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devLongArrRange( cl_long *a, cl_mem ad, size_t offset, size_t n);
+extern void host2devULongArrRange( cl_ulong *a, cl_mem ad, size_t offset, size_t n);
+
+extern void host2devDoubleArrRect( double *a, cl_mem ad, size_t *origin,
+                                   size_t *region, size_t row_len, size_t num_rows);
+extern void host2devFloatArrRect( float *a, cl_mem ad, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
+extern void host2devIntArrRect( int *a, cl_mem ad, size_t *origin,
+                                size_t *region, size_t row_len, size_t num_rows);
+extern void host2devBoolArrRect( bool *a, cl_mem ad, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void host2devHalfArrRect( cl_half *a, cl_mem ad, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void host2devCharArrRect( cl_char *a, cl_mem ad, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void host2devUCharArrRect( cl_uchar *a, cl_mem ad, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
+extern void host2devShortArrRect( cl_short *a, cl_mem ad, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
+extern void host2devUShortArrRect( cl_ushort *a, cl_mem ad, size_t *origin,
+                                   size_t *region, size_t row_len, size_t num_rows);
+extern void host2devLongArrRect( cl_long *a, cl_mem ad, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void host2devULongArrRect( cl_ulong *a, cl_mem ad, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
 
 /*******************************************************************************
  *
@@ -245,6 +441,72 @@ extern void dev2hostDoubleArr( cl_mem ad, double *a, size_t n);
 extern void dev2hostFloatArr( cl_mem ad, float *a, size_t n);
 extern void dev2hostIntArr( cl_mem ad, int *a, size_t n);
 extern void dev2hostBoolArr( cl_mem ad, bool *a, size_t n);
+extern void dev2hostHalfArr( cl_mem ad, cl_half *a, size_t n);
+extern void dev2hostCharArr( cl_mem ad, cl_char *a, size_t n);
+extern void dev2hostUCharArr( cl_mem ad, cl_uchar *a, size_t n);
+extern void dev2hostShortArr( cl_mem ad, cl_short *a, size_t n);
+extern void dev2hostUShortArr( cl_mem ad, cl_ushort *a, size_t n);
+extern void dev2hostLongArr( cl_mem ad, cl_long *a, size_t n);
+extern void dev2hostULongArr( cl_mem ad, cl_ulong *a, size_t n);
+
+/*******************************************************************************
+ *
+ * host2devBytes : transfers the "n" bytes starting at byte "offset" of the
+ *                 host memory at "a" to the same bytes of the device buffer
+ *                 "ad". All typed host2dev variants are built on top of this.
+ *
+ * dev2hostBytes : transfers the "n" bytes starting at byte "offset" of the
+ *                 device buffer "ad" to the same bytes of the host memory "a".
+ *
+ ******************************************************************************/
+extern void host2devBytes( void *a, cl_mem ad, size_t offset, size_t n);
+extern void dev2hostBytes( cl_mem ad, void *a, size_t offset, size_t n);
+
+/*******************************************************************************
+ *
+ * dev2host<type>ArrRange : transfers the "n" elements starting at element
+ *                          "offset" of the device buffer "ad" to the same
+ *                          elements of the host array "a".
+ *
+ * dev2host<type>ArrRect : transfers a 2-D or 3-D box of the device buffer
+ *                         "ad" to the same box of the host array "a".
+ *                         The arguments are as for host2dev<type>ArrRect.
+ *
+ ******************************************************************************/
+extern void dev2hostDoubleArrRange( cl_mem ad, double *a, size_t offset, size_t n);
+extern void dev2hostFloatArrRange( cl_mem ad, float *a, size_t offset, size_t n);
+extern void dev2hostIntArrRange( cl_mem ad, int *a, size_t offset, size_t n);
+extern void dev2hostBoolArrRange( cl_mem ad, bool *a, size_t offset, size_t n);
+extern void dev2hostHalfArrRange( cl_mem ad, cl_half *a, size_t offset, size_t n);
+extern void dev2hostCharArrRange( cl_mem ad, cl_char *a, size_t offset, size_t n);
+extern void dev2hostUCharArrRange( cl_mem ad, cl_uchar *a, size_t offset, size_t n);
+extern void dev2hostShortArrRange( cl_mem ad, cl_short *a, size_t offset, size_t n);
+extern void dev2hostUShortArrRange( cl_mem ad, cl_ushort *a, size_t offset, size_t n);
+extern void dev2hostLongArrRange( cl_mem ad, cl_long *a, size_t offset, size_t n);
+extern void dev2hostULongArrRange( cl_mem ad, cl_ulong *a, size_t offset, size_t n);
+
+extern void dev2hostDoubleArrRect( cl_mem ad, double *a, size_t *origin,
+                                   size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostFloatArrRect( cl_mem ad, float *a, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostIntArrRect( cl_mem ad, int *a, size_t *origin,
+                                size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostBoolArrRect( cl_mem ad, bool *a, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostHalfArrRect( cl_mem ad, cl_half *a, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostCharArrRect( cl_mem ad, cl_char *a, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostUCharArrRect( cl_mem ad, cl_uchar *a, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostShortArrRect( cl_mem ad, cl_short *a, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostUShortArrRect( cl_mem ad, cl_ushort *a, size_t *origin,
+                                   size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostLongArrRect( cl_mem ad, cl_long *a, size_t *origin,
+                                 size_t *region, size_t row_len, size_t num_rows);
+extern void dev2hostULongArrRect( cl_mem ad, cl_ulong *a, size_t *origin,
+                                  size_t *region, size_t row_len, size_t num_rows);
 
 /*******************************************************************************
  *
@@ -252,9 +514,64 @@ extern void dev2hostBoolArr( cl_mem ad, bool *a, size_t n);
  *                It takes the following arguments:
  *               - the kernel source as a string
  *               - the name of the kernel function as string
+ *                The program is kept until the next createKernel or
+ *                freeDevice.
+ *
+ * createKernelWithProgram : like createKernel, but the program is returned in
+ *                <program> and owned by the caller, who releases it with
+ *                clReleaseProgram once the kernel is no longer needed.
  *
  ******************************************************************************/
 extern cl_kernel createKernel( const char *kernel_source, char *kernel_name);
+extern cl_kernel createKernelWithProgram( const char *kernel_source,
+                                          char *kernel_name, cl_program *program);
+
+/*******************************************************************************
+ *
+ * setKernelArg : sets a kernel argument like clSetKernelArg does, but checks
+ *                for errors and takes note of the argument while a session
+ *                is being captured (see startCapture).
+ *
+ ******************************************************************************/
+extern void setKernelArg( cl_kernel kernel, cl_uint idx, size_t size, const void *val);
+
+/*******************************************************************************
+ *
+ * startBuild : starts building a program from the source as string in the
+ *              background and returns a handle to the build immediately.
+ *              <options> are passed to clBuildProgram and may be NULL.
+ *              The source is copied, so it can be freed right away.
+ *              Starting all builds upfront lets them proceed concurrently,
+ *              e.g.:
+ *
+ *                 src = readOpenCL( "a.cl");
+ *                 b1 = startBuild( src, NULL);
+ *                 free( src);
+ *                 src = readOpenCL( "b.cl");
+ *                 b2 = startBuild( src, NULL);
+ *                 free( src);
+ *                 ...
+ *                 k1 = createKernelFromBuild( b1, "a");
+ *
+ * buildDone : returns true iff the build has finished (successfully or not).
+ *
+ * waitBuild : blocks until the build has finished and returns the program.
+ *             If the build failed, the build log is printed to stderr.
+ *
+ * createKernelFromBuild : creates the kernel <kernel_name> from the program
+ *             of the build; it only blocks if that build has not finished yet.
+ *
+ * freeBuild : releases the program and the handle. Kernels created from it
+ *             remain valid.
+ *
+ ******************************************************************************/
+typedef struct build_handle build_handle;
+
+extern build_handle *startBuild( const char *kernel_source, const char *options);
+extern bool buildDone( build_handle *b);
+extern cl_program waitBuild( build_handle *b);
+extern cl_kernel createKernelFromBuild( build_handle *b, char *kernel_name);
+extern void freeBuild( build_handle *b);
 
 /*******************************************************************************
  *
@@ -268,8 +585,168 @@ extern cl_kernel createKernel( const char *kernel_source, char *kernel_name);
  *             If anything goes wrong in the course, error messages will be
  *             printed to stderr and the last error encountered will be returned.
  *
+ *             Launches whose global size exceeds the maximum launch size
+ *             (see setMaxLaunchSize) in some axis are split into several
+ *             launches which are placed through global offsets. This is
+ *             transparent to the kernel as long as it uses get_global_id.
+ *
+ * launchKernelOffset : like launchKernel but the thread-space starts at
+ *             <offset> rather than at 0, i.e., get_global_id( i) ranges from
+ *             offset[i] to offset[i]+global[i]-1. This allows to process
+ *             individual tiles or updated regions of larger arrays.
+ *
  ******************************************************************************/
 extern cl_int launchKernel( cl_kernel kernel, int dim, size_t *global, size_t *local);
+extern cl_int launchKernelOffset( cl_kernel kernel, int dim, size_t *offset,
+                                  size_t *global, size_t *local);
+
+/*******************************************************************************
+ *
+ * setMaxLaunchSize : sets the maximum number of work items per axis that is
+ *                    enqueued in a single launch; larger launches are split.
+ *                    The default is derived from the address range of the
+ *                    device (CL_DEVICE_ADDRESS_BITS) at each initialisation:
+ *                    2^32-1, which many runtimes do not exceed for a single
+ *                    enqueue even on 64-bit devices. An explicit size is kept
+ *                    across freeDevice. The whole range of a launch, including
+ *                    its offset, has to fit into the address range in any
+ *                    case. A split launch counts as one kernel execution.
+ *
+ ******************************************************************************/
+extern void setMaxLaunchSize( size_t n);
+
+/*******************************************************************************
+ *
+ * startBatch : switches launchKernel (and thus runKernel) into batch mode.
+ *              In batch mode, kernels are only enqueued; there is no clFinish
+ *              after each launch. Synchronisation happens when syncBatch or
+ *              stopBatch are called, or automatically every <sync_every>
+ *              launches if <sync_every> is positive.
+ *              The kernel time of batched launches is taken from the
+ *              profiling events of the individual launches rather than
+ *              from wallclock measurements.
+ *
+ * syncBatch : waits for all outstanding launches to complete and accounts
+ *             their execution times.
+ *
+ * stopBatch : synchronises and switches back to the default mode where
+ *             every launch waits for its completion.
+ *
+ ******************************************************************************/
+extern void startBatch( int sync_every);
+extern cl_int syncBatch();
+extern cl_int stopBatch();
+
+/*******************************************************************************
+ *
+ * startConcurrent : lets independent launches run concurrently. If
+ *                   <out_of_order> is set and the device supports it, launches
+ *                   go to a single out-of-order queue; otherwise they are
+ *                   distributed round-robin over a pool of <num_queues>
+ *                   in-order queues. Concurrent mode implies batch mode
+ *                   (see startBatch); syncBatch waits for all queues.
+ *                   Ordering is derived from the buffer arguments: a launch
+ *                   waits for the last launch or transfer writing any buffer
+ *                   it uses and, for buffers it writes, for all launches
+ *                   reading them since. Transfers through the wrapper wait
+ *                   for the launches using their buffers accordingly.
+ *                   Only arguments set through setupKernel or setKernelArg
+ *                   while concurrent mode is active are tracked, so call
+ *                   startConcurrent before setting up the kernels.
+ *                   SVMPtr arguments of setupKernel are not tracked per
+ *                   allocation: all launches using SVM run one after the
+ *                   other. SVM set via clSetKernelArgSVMPointer directly is
+ *                   not tracked at all.
+ *
+ * stopConcurrent : synchronises, releases the additional queues and leaves
+ *                  batch mode.
+ *
+ * setArgAccess : declares how a kernel accesses a buffer argument. By default,
+ *                buffers are assumed to be read and written. For kernels
+ *                from startBuild with the option -cl-kernel-arg-info, const
+ *                arguments are detected as read-only; createKernel and
+ *                setupKernel do not use that option. Declaring read-only
+ *                inputs allows more launches to overlap. The declaration
+ *                holds until the argument is set again.
+ *
+ * releaseKernel : releases a kernel, the buffers setupKernel allocated for
+ *                 its array arguments and its argument bindings. Use this
+ *                 rather than clReleaseKernel for kernels from setupKernel
+ *                 or whose buffer arguments have been tracked in concurrent
+ *                 mode.
+ *
+ ******************************************************************************/
+typedef enum {
+  AccessRead = 1,
+  AccessWrite = 2,
+  AccessReadWrite = 3
+} arg_access;
+
+extern void startConcurrent( int num_queues, bool out_of_order);
+extern cl_int stopConcurrent();
+extern void setArgAccess( cl_kernel kernel, cl_uint idx, arg_access access);
+extern void releaseKernel( cl_kernel kernel);
+
+
+/*******************************************************************************
+ *
+ * Element-wise kernel fusion: chains of simple maps can be composed into an
+ * expression tree which is turned into a single fused kernel. This way, no
+ * intermediate arrays are materialised; only the inputs are read and only the
+ * result is written.
+ *
+ * ewArg : refers to the i-th input array of the expression.
+ * ewConst : a constant.
+ * ewUnary : applies one of EwNeg, EwSqr, EwSqrt, EwExp, EwAbs.
+ * ewBinary : applies one of EwAdd, EwSub, EwMul, EwDiv, EwMin, EwMax.
+ * ewFree : releases an expression tree. Note that every node must occur only
+ *          once in a tree!
+ *
+ * For example, computing 2*x*x + y reads:
+ *
+ *    e = ewBinary( EwAdd, ewBinary( EwMul, ewConst( 2.0),
+ *                                          ewUnary( EwSqr, ewArg( 0))),
+ *                         ewArg( 1));
+ *    runElementwise( FloatArr, e, count, results, 2, x, y);
+ *    ewFree( e);
+ *
+ * ewKernel : generates the fused kernel for arrays of <type> (one of DoubleArr,
+ *            FloatArr or IntArr) and builds it. Kernels are cached, i.e.,
+ *            identical expressions are built only once; freeDevice releases
+ *            them. The kernel expects the arguments (out, in0, ..., count)
+ *            where count is a cl_ulong.
+ *
+ * runElementwise : computes out[i] = e( in0[i], ...) for all 0 <= i < n in a
+ *                  single pass. It takes <num_inputs> input pointers of the
+ *                  given element type. For n == 0 it does nothing.
+ *
+ ******************************************************************************/
+typedef enum {
+  EwArg,
+  EwConst,
+  EwNeg,
+  EwSqr,
+  EwSqrt,
+  EwExp,
+  EwAbs,
+  EwAdd,
+  EwSub,
+  EwMul,
+  EwDiv,
+  EwMin,
+  EwMax
+} ew_op;
+
+typedef struct ew_expr ew_expr;
+
+extern ew_expr *ewArg( int i);
+extern ew_expr *ewConst( double val);
+extern ew_expr *ewUnary( ew_op op, ew_expr *a);
+extern ew_expr *ewBinary( ew_op op, ew_expr *a, ew_expr *b);
+extern void ewFree( ew_expr *e);
+extern cl_kernel ewKernel( clarg_type type, ew_expr *e, int num_inputs);
+extern void runElementwise( clarg_type type, ew_expr *e, size_t n, void *out,
+                            int num_inputs, ...);
 
 
 
@@ -285,14 +762,77 @@ extern cl_int launchKernel( cl_kernel kernel, int dim, size_t *global, size_t *l
  *                   launchKernel and runKernel. It does not matter how much
  *                   time elapses between the last call to runKernel and the
  *                   call to printKernelTime!
+ *                   In batch mode (see startBatch), only launches that have
+ *                   been synchronised are accounted for.
  *
  ******************************************************************************/
 extern void printKernelTime();
 extern void printTransferTimes();
 
+/*******************************************************************************
+ *
+ * Build options: compiling simple.c with -DSIMPLE_NO_INSTR removes all
+ *                wallclock timing and all verbose logging (initCPUVerbose and
+ *                initGPUVerbose behave like initCPU and initGPU) from the
+ *                wrapper; the timing functions above then report call counts
+ *                and transferred bytes only. Compiling it with
+ *                -DSIMPLE_COUNT_OVERHEAD enables the counter mode below.
+ *
+ * printOverhead : prints the number of calls to the instrumented entry points
+ *                 (transfers, setKernelArg, launchKernel, runKernel, syncBatch),
+ *                 the total time spent in them and the part of it spent inside
+ *                 openCL calls. The difference is the overhead of the wrapper
+ *                 itself. Nested entry points are counted once.
+ *
+ * resetOverhead : resets the counters of printOverhead, e.g., after warm-up.
+ *
+ ******************************************************************************/
+extern void printOverhead();
+extern void resetOverhead();
+
 
 
 
+/*******************************************************************************
+ *
+ * startCapture : starts recording the session into the binary file <fname>.
+ *                Recorded are the sources, names and build options of all
+ *                kernels created, all buffer allocations, all transfers
+ *                including the uploaded data, all kernel arguments set
+ *                through setupKernel or setKernelArg, all launches and all
+ *                batch synchronisations. Kernels and buffers used while
+ *                capturing need to be created after startCapture.
+ *                SVM arguments cannot be captured.
+ *
+ * stopCapture : finishes the recording and closes the file. freeDevice
+ *               does so implicitly.
+ *
+ * loadSession : reads the capture file <fname> and builds all kernels it
+ *               contains on the current device. The returned handle can be
+ *               executed any number of times.
+ *
+ * runSession : re-executes all recorded allocations, transfers, arguments and
+ *              launches of a loaded session and returns the number of kernel
+ *              launches replayed. Buffers are allocated and freed within each
+ *              run. The usual time measurements (printKernelTime,
+ *              printTransferTimes) apply.
+ *
+ * freeSession : releases the kernels and programs of a loaded session.
+ *
+ * replaySession : loads, runs and frees the session in <fname> once.
+ *                 See tools/replay.c for a standalone replay tool.
+ *
+ ******************************************************************************/
+typedef struct replay_session replay_session;
+
+extern void startCapture( const char *fname);
+extern void stopCapture();
+extern replay_session *loadSession( const char *fname);
+extern int runSession( replay_session *s);
+extern void freeSession( replay_session *s);
+extern int replaySession( const char *fname);
+
+
 /*******************************************************************************
  *
  * maxWorkItems : returns the maximum number of work items per work group of the
@@ -303,5 +843,8 @@ extern void printTransferTimes();
 extern size_t maxWorkItems (int dim);
 
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* SIMPLE_H_ */
@@ -0,0 +1,241 @@
+#ifndef SIMPLE_HPP_
+#define SIMPLE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "simple.h"
+
+/*******************************************************************************
+ *******************************************************************************
+
+ C++ Layer
+
+     This header adds a type-safe layer on top of simple.h for C++20.
+     Instead of the varargs-based setupKernel/runKernel, the kinds of the
+     kernel arguments are deduced from their C++ types at compile time:
+
+        std::span<T>        array argument that is copied to the device and,
+                            after the launch, copied back to the host
+        std::span<const T>  array argument that is only copied to the device
+        T (arithmetic)      scalar argument passed by value
+
+     The sequence of clSetKernelArg calls is generated by the compiler; there
+     is no runtime dispatch on argument tags and no limit on the number of
+     arguments. Device buffers and kernels are RAII handles that are released
+     deterministically when they go out of scope. A typical use looks like:
+
+        simple::Device dev( simple::GPU, true);
+        simple::Kernel square( source, "square");
+
+        square.run<1>( {count}, {32}, std::span<const float>( data, count),
+                                      std::span<float>( results, count),
+                                      (unsigned int)count);
+
+     The C API remains fully usable alongside this layer.
+
+ *******************************************************************************
+ ******************************************************************************/
+
+namespace simple {
+
+enum DeviceType { CPU, GPU };
+
+/*******************************************************************************
+ *
+ * Device : initialises the openCL environment on construction and releases
+ *          all resources via freeDevice on destruction.
+ *
+ ******************************************************************************/
+class Device {
+public:
+  explicit Device( DeviceType type = GPU, bool verbose = false)
+  {
+    if (type == CPU) {
+      CL_SAFE(verbose ? initCPUVerbose() : initCPU());
+    } else {
+      CL_SAFE(verbose ? initGPUVerbose() : initGPU());
+    }
+  }
+  ~Device() { freeDevice(); }
+
+  Device( const Device &) = delete;
+  Device &operator=( const Device &) = delete;
+};
+
+/*******************************************************************************
+ *
+ * Buffer : owns a device buffer of a given number of bytes obtained from
+ *          allocDev; it is released through freeDev on destruction.
+ *
+ ******************************************************************************/
+class Buffer {
+public:
+  explicit Buffer( size_t bytes) : mem_( allocDev( bytes)) {}
+  ~Buffer() { if (mem_ != nullptr) freeDev( mem_); }
+
+  Buffer( const Buffer &) = delete;
+  Buffer &operator=( const Buffer &) = delete;
+  Buffer( Buffer &&other) noexcept : mem_( std::exchange( other.mem_, nullptr)) {}
+  Buffer &operator=( Buffer &&other) noexcept
+  {
+    std::swap( mem_, other.mem_);
+    return *this;
+  }
+
+  cl_mem get() const { return mem_; }
+
+private:
+  cl_mem mem_;
+};
+
+namespace detail {
+
+/* typed transfers; the C API does not modify the source arrays. cl_half is
+   the same type as cl_ushort, so half data travels as std::span<cl_ushort> */
+inline void upload( const double *a, cl_mem ad, size_t n) { host2devDoubleArr( const_cast<double *>( a), ad, n); }
+inline void upload( const float *a, cl_mem ad, size_t n)  { host2devFloatArr( const_cast<float *>( a), ad, n); }
+inline void upload( const int *a, cl_mem ad, size_t n)    { host2devIntArr( const_cast<int *>( a), ad, n); }
+inline void upload( const bool *a, cl_mem ad, size_t n)   { host2devBoolArr( const_cast<bool *>( a), ad, n); }
+inline void upload( const cl_char *a, cl_mem ad, size_t n)   { host2devCharArr( const_cast<cl_char *>( a), ad, n); }
+inline void upload( const cl_uchar *a, cl_mem ad, size_t n)  { host2devUCharArr( const_cast<cl_uchar *>( a), ad, n); }
+inline void upload( const cl_short *a, cl_mem ad, size_t n)  { host2devShortArr( const_cast<cl_short *>( a), ad, n); }
+inline void upload( const cl_ushort *a, cl_mem ad, size_t n) { host2devUShortArr( const_cast<cl_ushort *>( a), ad, n); }
+inline void upload( const cl_long *a, cl_mem ad, size_t n)   { host2devLongArr( const_cast<cl_long *>( a), ad, n); }
+inline void upload( const cl_ulong *a, cl_mem ad, size_t n)  { host2devULongArr( const_cast<cl_ulong *>( a), ad, n); }
+
+inline void download( cl_mem ad, double *a, size_t n) { dev2hostDoubleArr( ad, a, n); }
+inline void download( cl_mem ad, float *a, size_t n)  { dev2hostFloatArr( ad, a, n); }
+inline void download( cl_mem ad, int *a, size_t n)    { dev2hostIntArr( ad, a, n); }
+inline void download( cl_mem ad, bool *a, size_t n)   { dev2hostBoolArr( ad, a, n); }
+inline void download( cl_mem ad, cl_char *a, size_t n)   { dev2hostCharArr( ad, a, n); }
+inline void download( cl_mem ad, cl_uchar *a, size_t n)  { dev2hostUCharArr( ad, a, n); }
+inline void download( cl_mem ad, cl_short *a, size_t n)  { dev2hostShortArr( ad, a, n); }
+inline void download( cl_mem ad, cl_ushort *a, size_t n) { dev2hostUShortArr( ad, a, n); }
+inline void download( cl_mem ad, cl_long *a, size_t n)   { dev2hostLongArr( ad, a, n); }
+inline void download( cl_mem ad, cl_ulong *a, size_t n)  { dev2hostULongArr( ad, a, n); }
+
+/* the state a single kernel argument needs while the kernel runs */
+template <typename T>
+struct bound_arg {
+  static_assert( std::is_arithmetic_v<T>,
+                 "kernel arguments must be std::span<T> or arithmetic scalars");
+  static_assert( !std::is_same_v<T, bool>,
+                 "bool is not a legal scalar kernel argument type in OpenCL");
+
+  bound_arg( cl_kernel kernel, cl_uint idx, T val)
+  {
+    setKernelArg (kernel, idx, sizeof (T), &val);
+  }
+  void fetch() {}
+};
+
+template <typename T>
+struct bound_arg<std::span<T>> {
+  bound_arg( cl_kernel kernel, cl_uint idx, std::span<T> h)
+    : buf( h.size_bytes()), host( h)
+  {
+    cl_mem mem = buf.get();
+    upload( host.data(), mem, host.size());
+    setKernelArg (kernel, idx, sizeof (cl_mem), &mem);
+  }
+  void fetch()
+  {
+    if constexpr (!std::is_const_v<T>)
+      download( buf.get(), host.data(), host.size());
+  }
+
+  Buffer       buf;
+  std::span<T> host;
+};
+
+/* compile-time list of bound arguments; argument I is bound to index I */
+template <cl_uint I, typename... Ts>
+struct bound_args {
+  explicit bound_args( cl_kernel) {}
+  void fetch() {}
+};
+
+template <cl_uint I, typename T, typename... Ts>
+struct bound_args<I, T, Ts...> {
+  bound_args( cl_kernel kernel, T first, Ts... rest)
+    : head( kernel, I, first), tail( kernel, rest...) {}
+  void fetch()
+  {
+    head.fetch();
+    tail.fetch();
+  }
+
+  bound_arg<T>              head;
+  bound_args<I + 1, Ts...>  tail;
+};
+
+} /* namespace detail */
+
+/*******************************************************************************
+ *
+ * Kernel : owns a kernel created from source via createKernelWithProgram
+ *          and its program; both are released on destruction.
+ *
+ * run : sets up all arguments, launches the kernel over the given <D>
+ *       dimensional thread space and copies back all mutable spans. The
+ *       device buffers of the arguments are released before run returns.
+ *
+ ******************************************************************************/
+class Kernel {
+public:
+  Kernel( const char *kernel_source, const char *kernel_name)
+    : program_( nullptr),
+      kernel_( createKernelWithProgram( kernel_source, const_cast<char *>( kernel_name),
+                                        &program_)) {}
+  ~Kernel() { release(); }
+
+  Kernel( const Kernel &) = delete;
+  Kernel &operator=( const Kernel &) = delete;
+  Kernel( Kernel &&other) noexcept
+    : program_( std::exchange( other.program_, nullptr)),
+      kernel_( std::exchange( other.kernel_, nullptr)) {}
+  Kernel &operator=( Kernel &&other) noexcept
+  {
+    if (this != &other) {
+      release();
+      program_ = std::exchange( other.program_, nullptr);
+      kernel_ = std::exchange( other.kernel_, nullptr);
+    }
+    return *this;
+  }
+
+  cl_kernel get() const { return kernel_; }
+
+  template <size_t D, typename... Args>
+  void run( std::array<size_t, D> global, std::array<size_t, D> local, Args... args)
+  {
+    static_assert( D >= 1 && D <= 3, "the thread space must have 1 to 3 dimensions");
+    detail::bound_args<0, Args...> bound( kernel_, args...);
+    launchKernel( kernel_, D, global.data(), local.data());
+    bound.fetch();
+  }
+
+private:
+  void release()
+  {
+    if (kernel_ != nullptr)
+      releaseKernel( kernel_);
+    if (program_ != nullptr)
+      clReleaseProgram( program_);
+    kernel_ = nullptr;
+    program_ = nullptr;
+  }
+
+  cl_program program_;
+  cl_kernel  kernel_;
+};
+
+} /* namespace simple */
+
+#endif /* SIMPLE_HPP_ */
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <CL/cl.h>
+#include "simple.h"
+
+/*
+ * Micro-benchmark comparing raw openCL with the wrapper for a small
+ * upload / set arguments / launch / download cycle, e.g.:
+ *
+ *    overhead -gpu -n 1024 -i 10000
+ *
+ * Built against a wrapper compiled with -DSIMPLE_COUNT_OVERHEAD (make
+ * overhead_count), it also reports how much of the wrapper time is spent
+ * inside openCL calls; built with -DSIMPLE_NO_INSTR (make overhead_release),
+ * it shows the cost of the wrapper without any timing or logging.
+ */
+
+const char *KernelSource =                                 "\n"
+  "__kernel void inc(                                       \n"
+  "   __global float* a,                                    \n"
+  "   const unsigned int count)                             \n"
+  "{                                                        \n"
+  "   size_t i = get_global_id(0);                          \n"
+  "   if (i < count)                                        \n"
+  "       a[i] = a[i] + 1.0f;                               \n"
+  "}                                                        \n"
+  "\n";
+
+#define WARMUP 10
+
+void usage( char *prog)
+{
+  fprintf( stderr, "usage: %s [-cpu|-gpu] [-n elements] [-i iterations]\n", prog);
+  exit( EXIT_FAILURE);
+}
+
+double elapsed( struct timespec *start, struct timespec *stop)
+{
+  return (stop->tv_sec -start->tv_sec)*1000.0
+         + (stop->tv_nsec -start->tv_nsec)/1000000.0;
+}
+
+/* one cycle via the plain openCL API on a context of its own */
+double runRaw( bool cpu, float *data, unsigned int count, int iters)
+{
+  struct timespec start, stop;
+  cl_uint num_platforms;
+  cl_platform_id *platforms;
+  cl_device_id device;
+  cl_context context;
+  cl_command_queue queue;
+  cl_program program;
+  cl_kernel kernel;
+  cl_mem buf;
+  cl_int err;
+  size_t global = count;
+  size_t bytes = sizeof (float) * count;
+
+  /* pick the device the same way initDevice does */
+  CL_SAFE(clGetPlatformIDs( 0, NULL, &num_platforms));
+  platforms = (cl_platform_id *)malloc( sizeof (cl_platform_id) * num_platforms);
+  if (platforms == NULL) {
+    fprintf( stderr, "Error: failed to allocate memory for %u platforms\n", num_platforms);
+    exit( EXIT_FAILURE);
+  }
+  CL_SAFE(clGetPlatformIDs( num_platforms, platforms, NULL));
+  err = CL_DEVICE_NOT_FOUND;
+  for( cl_uint i=0; (i<num_platforms) && (err != CL_SUCCESS); i++)
+    err = clGetDeviceIDs( platforms[i], (cpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU),
+                          1, &device, NULL);
+  free( platforms);
+  CL_SAFE(err);
+  context = clCreateContext( NULL, 1, &device, NULL, NULL, &err);
+  CL_SAFE(err);
+#ifdef CL_VERSION_2_0
+  queue = clCreateCommandQueueWithProperties( context, device, NULL, &err);
+#else
+  queue = clCreateCommandQueue( context, device, 0, &err);
+#endif
+  CL_SAFE(err);
+  program = clCreateProgramWithSource( context, 1, &KernelSource, NULL, &err);
+  CL_SAFE(err);
+  CL_SAFE(clBuildProgram( program, 0, NULL, NULL, NULL, NULL));
+  kernel = clCreateKernel( program, "inc", &err);
+  CL_SAFE(err);
+  buf = clCreateBuffer( context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+  CL_SAFE(err);
+
+  for( int i=0; i<WARMUP+iters; i++) {
+    if (i == WARMUP)
+      clock_gettime( CLOCK_REALTIME, &start);
+    CL_SAFE(clEnqueueWriteBuffer( queue, buf, CL_TRUE, 0, bytes, data, 0, NULL, NULL));
+    CL_SAFE(clSetKernelArg( kernel, 0, sizeof (cl_mem), &buf));
+    CL_SAFE(clSetKernelArg( kernel, 1, sizeof (unsigned int), &count));
+    CL_SAFE(clEnqueueNDRangeKernel( queue, kernel, 1, NULL, &global, NULL, 0, NULL, NULL));
+    CL_SAFE(clFinish( queue));
+    CL_SAFE(clEnqueueReadBuffer( queue, buf, CL_TRUE, 0, bytes, data, 0, NULL, NULL));
+  }
+  clock_gettime( CLOCK_REALTIME, &stop);
+
+  CL_SAFE(clReleaseMemObject( buf));
+  CL_SAFE(clReleaseKernel( kernel));
+  CL_SAFE(clReleaseProgram( program));
+  CL_SAFE(clReleaseCommandQueue( queue));
+  CL_SAFE(clReleaseContext( context));
+
+  return elapsed( &start, &stop);
+}
+
+/* the same cycle through the wrapper */
+double runWrapper( bool cpu, float *data, unsigned int count, int iters)
+{
+  struct timespec start, stop;
+  cl_kernel kernel;
+  cl_mem buf;
+  size_t global = count;
+
+  CL_SAFE(cpu ? initCPU() : initGPU());
+  kernel = createKernel( KernelSource, "inc");
+  buf = allocDev( sizeof (float) * count);
+
+  for( int i=0; i<WARMUP+iters; i++) {
+    if (i == WARMUP) {
+      resetOverhead();
+      clock_gettime( CLOCK_REALTIME, &start);
+    }
+    host2devFloatArr( data, buf, count);
+    setKernelArg( kernel, 0, sizeof (cl_mem), &buf);
+    setKernelArg( kernel, 1, sizeof (unsigned int), &count);
+    launchKernel( kernel, 1, &global, NULL);
+    dev2hostFloatArr( buf, data, count);
+  }
+  clock_gettime( CLOCK_REALTIME, &stop);
+
+  freeDev( buf);
+  releaseKernel( kernel);
+
+  return elapsed( &start, &stop);
+}
+
+int main (int argc, char * argv[])
+{
+  bool cpu = false;
+  unsigned int count = 1024;
+  int iters = 10000;
+  float *data;
+  double raw, wrapped;
+
+  for( int i=1; i<argc; i++) {
+    if (strcmp( argv[i], "-cpu") == 0) {
+      cpu = true;
+    } else if (strcmp( argv[i], "-gpu") == 0) {
+      cpu = false;
+    } else if ((strcmp( argv[i], "-n") == 0) && (i+1 < argc)) {
+      count = atoi( argv[++i]);
+    } else if ((strcmp( argv[i], "-i") == 0) && (i+1 < argc)) {
+      iters = atoi( argv[++i]);
+    } else {
+      usage( argv[0]);
+    }
+  }
+  if ((count == 0) || (iters < 1))
+    usage( argv[0]);
+
+  data = (float *)calloc( count, sizeof (float));
+  if (data == NULL)
+    usage( argv[0]);
+
+  raw = runRaw( cpu, data, count, iters);
+  wrapped = runWrapper( cpu, data, count, iters);
+  if (data[count-1] != 2.0f * (WARMUP + iters))
+    fprintf( stderr, "Warning: unexpected result %f\n", data[count-1]);
+
+  printf( "%d cycles of %u floats\n", iters, count);
+  printf( "raw openCL: %s", getTimeStr( raw));
+  printf( " (%.3f usec per cycle)\n", raw * 1000.0 / iters);
+  printf( "wrapper:    %s", getTimeStr( wrapped));
+  printf( " (%.3f usec per cycle)\n", wrapped * 1000.0 / iters);
+  printf( "difference: %.3f usec per cycle\n", (wrapped - raw) * 1000.0 / iters);
+  printOverhead();
+
+  CL_SAFE(freeDevice());
+  free( data);
+
+  return 0;
+}
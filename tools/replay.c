@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <CL/cl.h>
+#include "simple.h"
+
+/*
+ * Replays a session captured through startCapture on any device and reports
+ * the times spent, e.g.:
+ *
+ *    replay -cpu -n 10 session.cap
+ */
+
+void usage( char *prog)
+{
+  fprintf( stderr, "usage: %s [-cpu|-gpu] [-v] [-n repetitions] <capture-file>\n", prog);
+  exit( EXIT_FAILURE);
+}
+
+int main (int argc, char * argv[])
+{
+  struct timespec start, stop;
+  bool cpu = false;
+  bool verbose = false;
+  int reps = 1;
+  char *fname = NULL;
+  replay_session *session;
+  int launches = 0;
+
+  for( int i=1; i<argc; i++) {
+    if (strcmp( argv[i], "-cpu") == 0) {
+      cpu = true;
+    } else if (strcmp( argv[i], "-gpu") == 0) {
+      cpu = false;
+    } else if (strcmp( argv[i], "-v") == 0) {
+      verbose = true;
+    } else if ((strcmp( argv[i], "-n") == 0) && (i+1 < argc)) {
+      reps = atoi( argv[++i]);
+    } else if (fname == NULL) {
+      fname = argv[i];
+    } else {
+      usage( argv[0]);
+    }
+  }
+  if ((fname == NULL) || (reps < 1))
+    usage( argv[0]);
+
+  if (cpu) {
+    CL_SAFE(verbose ? initCPUVerbose() : initCPU());
+  } else {
+    CL_SAFE(verbose ? initGPUVerbose() : initGPU());
+  }
+
+  session = loadSession( fname);
+  clock_gettime( CLOCK_REALTIME, &start);
+  for( int i=0; i<reps; i++)
+    launches += runSession( session);
+  clock_gettime( CLOCK_REALTIME, &stop);
+  freeSession( session);
+
+  printf( "replayed %d kernel launches in %d repetitions\n", launches, reps);
+  printf( "total wallclock time: %s\n",
+          getTimeStr( (stop.tv_sec -start.tv_sec)*1000.0
+                      + (stop.tv_nsec -start.tv_nsec)/1000000.0));
+  printKernelTime();
+  printTransferTimes();
+
+  CL_SAFE(freeDevice());
+
+  return 0;
+}